@@ -134,6 +134,7 @@ struct tw_globals {
 			bool key_pressed;
 			xkb_keycode_t keycode;
 			xkb_keysym_t keysym;
+			struct tw_event_timer *repeat_timer;
 		};
 		//pointer, touch use this as well
 		struct {
@@ -161,6 +162,9 @@ struct tw_globals {
 	//application theme settings
 	const struct tw_theme *theme;
 	struct tw_event_queue event_queue;
+	/* shm surfaces take their buffers from here instead of a pool of
+	 * their own, if set */
+	struct tw_shm_arena *shm_arena;
 };
 
 
@@ -184,6 +188,15 @@ tw_globals_init(struct tw_globals *globals, struct wl_display *display);
 void
 tw_globals_release(struct tw_globals *globals);
 
+/**
+ * @brief share a shm arena among the shm surfaces created from now on
+ *
+ * Call it once wl_shm and the buffer format are known. The arena goes away in
+ * `tw_globals_release`.
+ */
+bool
+tw_globals_use_shm_arena(struct tw_globals *globals, size_t pool_size);
+
 static inline void
 tw_globals_dispatch_event_queue(struct tw_globals *globals)
 {
@@ -24,6 +24,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <time.h>
 #include <wayland-util.h>
 #include <wayland-client.h>
@@ -35,9 +36,42 @@ extern "C" {
 #endif
 
 struct udev_device;
+struct tw_event_source;
+struct tw_event_timer;
+struct tw_event_timer_wheel;
+struct tw_event_slabs;
+struct tw_event_idle_map;
+struct tw_event_mailbox;
+struct tw_work_pool;
+struct tw_event_uring;
+struct tw_event_stats;
+struct tw_event_inotify;
+struct tw_event_udev;
+struct tw_event_signals;
+struct tw_event_trace;
 
 //this is accessible API
-enum tw_event_op { TW_EVENT_NOOP, TW_EVENT_DEL };
+/**
+ * @brief returned by the source callbacks
+ *
+ * TW_EVENT_AGAIN tells the queue the source is not drained yet, it is run
+ * again in the next iteration without waiting for the kernel.
+ */
+enum tw_event_op { TW_EVENT_NOOP, TW_EVENT_DEL, TW_EVENT_AGAIN };
+
+/**
+ * @brief the ready sources are dispatched from high to low, the wl_display is
+ * high by default and the rest default.
+ */
+enum tw_event_priority {
+	TW_EVENT_PRIORITY_HIGH,
+	TW_EVENT_PRIORITY_DEFAULT,
+	TW_EVENT_PRIORITY_LOW,
+};
+#define TW_EVENT_PRIORITIES 3
+
+/* default time for idle tasks in one iteration */
+#define TW_EVENT_IDLE_BUDGET_US 4000
 
 struct tw_event {
 	void *data;
@@ -46,6 +80,52 @@ struct tw_event {
 	int (*cb)(struct tw_event *event, int fd);
 };
 
+struct tw_event_alloc_stats {
+	uint64_t sys_allocs; /**< chunks allocated from the system */
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t in_use;
+};
+
+struct tw_event_queue_alloc_stats {
+	struct tw_event_alloc_stats sources;
+	struct tw_event_alloc_stats idle_tasks;
+	struct tw_event_alloc_stats timers;
+};
+
+#define TW_EVENT_HIST_BUCKETS 16
+
+/**
+ * @brief time histogram, bucket i counts the samples in [2^(i-1), 2^i)
+ * microseconds, the last bucket takes all the longer ones.
+ */
+struct tw_event_hist {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t buckets[TW_EVENT_HIST_BUCKETS];
+};
+
+struct tw_event_queue_stats {
+	uint64_t wakeups; /**< returns from epoll_wait or the ring */
+	uint64_t elapsed_ns; /**< since the queue was created */
+	struct tw_event_hist wait_time; /**< blocked in the kernel */
+	struct tw_event_hist idle_time; /**< per idle task */
+};
+
+struct tw_event_source_stats {
+	struct tw_event_hist read_time; /**< draining timers and inotify */
+	struct tw_event_hist dispatch_time;
+};
+
+/* wakeups counted over whole minutes */
+struct tw_event_wakeups {
+	uint64_t total;
+	uint64_t window_start; /**< in ms of CLOCK_MONOTONIC */
+	uint32_t window; /**< wakeups since window_start */
+	uint32_t last_minute;
+};
+
 //client side event processor
 struct tw_event_queue {
 	struct wl_display *wl_display;
@@ -53,16 +133,82 @@ struct tw_event_queue {
 	struct wl_list head;
 	struct wl_list idle_tasks;
 	bool quit;
+	/* ready sources by priority, carried to the next iteration */
+	struct wl_list ready[TW_EVENT_PRIORITIES];
+	/* time for the idle tasks in one iteration, 0 runs all of them */
+	uint32_t idle_budget_us;
+	struct tw_event_wakeups wakeups;
 
-
+	/* fd indexed table of the sources in `head`, for O(1) lookup */
+	struct tw_event_source **sources;
+	int sources_len;
+	/* timers sharing one timerfd, created on first use */
+	struct tw_event_timer_wheel *timers;
+	/* free list allocators for sources, idle tasks and timers */
+	struct tw_event_slabs *slabs;
+	/* keyed idle tasks in the queue */
+	struct tw_event_idle_map *idle_keys;
+	/* events posted from other threads */
+	struct tw_event_mailbox *mailbox;
+	/* worker threads, spawned on the first submitted work */
+	struct tw_work_pool *workers;
+	/* io_uring backend, NULL when we poll with epoll */
+	struct tw_event_uring *uring;
+	/* loop instrumentation, NULL unless built with _TW_EVENT_STATS */
+	struct tw_event_stats *stats;
+	/* inotify shared by all the file watches, created on first use */
+	struct tw_event_inotify *inotify;
+	/* udev monitors, one per subsystem */
+	struct tw_event_udev *udev;
+	/* the signalfd and the spawned children */
+	struct tw_event_signals *signals;
+	/* the recorder, see `tw_event_queue_start_trace` */
+	struct tw_event_trace *trace;
 };
 
 void
 tw_event_queue_run(struct tw_event_queue *queue);
 
+/**
+ * @brief the fd to poll when the queue is nested in another main loop
+ *
+ * It becomes readable when `tw_event_queue_dispatch` has work to do, timers
+ * included. Call `tw_event_queue_next_timeout` before going to sleep on it.
+ */
+int
+tw_event_queue_get_fd(struct tw_event_queue *queue);
+
+/**
+ * @brief run one iteration of the loop
+ *
+ * Runs the idle tasks, waits for at most `timeout_ms` (-1 blocks, 0 does not
+ * wait) and dispatches the ready sources. Returns the number of sources
+ * dispatched, or -1 if the queue is closed.
+ */
+int
+tw_event_queue_dispatch(struct tw_event_queue *queue, int timeout_ms);
+
+/**
+ * @brief flush the pending requests and get the time in ms until the queue
+ * needs a dispatch
+ *
+ * 0 if there is work left, -1 if there are no timers. The deadline is only a
+ * hint for the outer loop, the fd wakes up for the timers as well.
+ */
+int
+tw_event_queue_next_timeout(struct tw_event_queue *queue);
+
 bool
 tw_event_queue_init(struct tw_event_queue *queue);
 
+/**
+ * @brief remove all the sources and release the queue
+ *
+ * `tw_event_queue_run` calls it when it quits.
+ */
+void
+tw_event_queue_close(struct tw_event_queue *queue);
+
 
 /**
  * @brief add directly a epoll fd to event queue
@@ -88,41 +234,255 @@ tw_event_queue_modify_source(struct tw_event_queue *queue, int fd,
 /**
  * @brief add a file to inotify watch system
  *
- * this adds a inotify fd to event queue, this does not work for sysfs
+ * All the files share one inotify fd of the queue. Returns the watch
+ * descriptor, which is also the fd argument of the callback, or -1. The
+ * callback runs once per wakeup with all the changes of the file, see
+ * `tw_event_get_file_changes`. A file is watched once, adding it again
+ * fails until it is removed. This does not work for sysfs.
  */
 int
 tw_event_queue_add_file(struct tw_event_queue *queue, const char *path,
                         struct tw_event *e, uint32_t mask);
 
+bool
+tw_event_queue_remove_file(struct tw_event_queue *queue, int wd);
+
+struct tw_event_file_change {
+	uint32_t mask; /**< IN_* bits */
+	uint32_t cookie; /**< pairs IN_MOVED_FROM with IN_MOVED_TO */
+	const char *name; /**< entry in the watched directory, or NULL */
+};
+
+/**
+ * @brief get the changes of the watch `wd`, only valid in its callback
+ *
+ * A watch with IN_IGNORED in its changes is gone after the callback.
+ */
+const struct tw_event_file_change *
+tw_event_get_file_changes(struct tw_event_queue *queue, int wd, size_t *n);
+
 /**
  * @brief add a device to udev monitoring system
  *
- * subsystem shouldn't be none.
+ * subsystem shouldn't be none. The watches of one subsystem share a udev
+ * monitor, the events are matched against `devname` in process: a path
+ * matches the device node, anything else the start of the sysname. NULL takes
+ * every device of the subsystem. Returns a handle passed to the callback as
+ * its fd, or -1.
  */
 int
 tw_event_queue_add_device(struct tw_event_queue *queue, const char *subsystem,
                           const char *devname, struct tw_event *e);
 
 /**
- * @brief returns an allocated udev_device
+ * @brief like `tw_event_queue_add_device`, the kernel only sends us the
+ * devices with the udev `tag`
+ */
+int
+tw_event_queue_add_tagged_device(struct tw_event_queue *queue,
+                                 const char *subsystem, const char *tag,
+                                 const char *devname, struct tw_event *e);
+
+bool
+tw_event_queue_remove_device(struct tw_event_queue *queue, int handle);
+
+/**
+ * @brief returns the udev_device of the event
  *
- * you have the responsibility to free the allocated `udev_device` by calling
- * `udev_device_unref`. And you should only call this function with udev event,
- * otherwise the behavior is undefined
+ * you have the responsibility to free the returned `udev_device` by calling
+ * `udev_device_unref`. It is NULL outside of the callback of `handle`.
  */
 struct udev_device *
-tw_event_get_udev_device(struct tw_event_queue *queue, int fd);
+tw_event_get_udev_device(struct tw_event_queue *queue, int handle);
 
+/**
+ * @brief get the signal `signo` on the loop instead of a handler
+ *
+ * The signal is blocked in the calling thread and read from one signalfd of
+ * the queue, call it from the main thread before spawning other threads. The
+ * callback gets `signo` as its fd, the same signal arriving twice between
+ * dispatches calls it once. Returns `signo` or -1.
+ */
+int
+tw_event_queue_add_signal(struct tw_event_queue *queue, int signo,
+                          struct tw_event *e);
+
+/**
+ * @brief stop getting `signo` and unblock it if it was blocked by us
+ */
+bool
+tw_event_queue_remove_signal(struct tw_event_queue *queue, int signo);
+
+/**
+ * @brief run `argv[0]` from PATH and get its exit on the loop
+ *
+ * The child is started with posix_spawn, with the default signal handlers and
+ * an empty signal mask, and watched through a pidfd. The callback runs once it
+ * exits with its pid as the fd, the child is reaped by then. Returns the pid
+ * or -1, a child we cannot watch, without pidfds or out of fds, is killed and
+ * reaped before returning. Do not reap the children yourself, or ignore
+ * SIGCHLD.
+ */
+int
+tw_event_queue_spawn(struct tw_event_queue *queue, char *const argv[],
+                     struct tw_event *e);
+
+/**
+ * @brief get the wait status of `pid`, only valid in its callback
+ *
+ * Use it with WIFEXITED and friends, -1 if it is not known.
+ */
+int
+tw_event_get_exit_status(struct tw_event_queue *queue, int pid);
+
+/**
+ * @brief add a timer with its own timerfd
+ *
+ * This is kept for compatibility, the fd can be used with
+ * `tw_event_queue_remove_source`. Every call costs a timerfd and an epoll
+ * registration, prefer `tw_event_queue_start_timer` for short living timers.
+ */
 int
 tw_event_queue_add_timer(struct tw_event_queue *queue,
                          const struct itimerspec *interval,
                          struct tw_event *event);
+
+/**
+ * @brief start a timer on the timer wheel of the queue
+ *
+ * All the timers started this way share a single timerfd and have a
+ * millisecond resolution, adding, cancelling and re-arming them is cheap. The
+ * callback is called with fd -1, it stops the timer by returning
+ * TW_EVENT_DEL. One-shot timers (zero `it_interval`) stop after firing. The
+ * returned handle is not valid anymore once the timer stopped.
+ */
+struct tw_event_timer *
+tw_event_queue_start_timer(struct tw_event_queue *queue,
+                           const struct itimerspec *spec,
+                           struct tw_event *event);
+
+/**
+ * @brief let the timer fire up to `slack_ms` late
+ *
+ * The timer snaps to the coarsest of a 1s, 250ms, 100ms, 50ms or 10ms grid
+ * within its slack, so the timers of the periodic widgets fire together in
+ * one wakeup. Periodic timers keep their nominal period.
+ */
+void
+tw_event_queue_set_timer_slack(struct tw_event_queue *queue,
+                               struct tw_event_timer *timer,
+                               uint32_t slack_ms);
+
+/**
+ * @brief re-arm a running timer with a new spec, relative to now
+ */
+bool
+tw_event_queue_rearm_timer(struct tw_event_queue *queue,
+                           struct tw_event_timer *timer,
+                           const struct itimerspec *spec);
+
+/**
+ * @brief stop and free a running timer
+ *
+ * It is safe to call within the timer's own callback.
+ */
+void
+tw_event_queue_cancel_timer(struct tw_event_queue *queue,
+                            struct tw_event_timer *timer);
 int
 tw_event_queue_add_wl_display(struct tw_event_queue *queue,
                               struct wl_display *d);
 bool
+tw_event_queue_set_priority(struct tw_event_queue *queue, int fd,
+                            enum tw_event_priority priority);
+
+bool
 tw_event_queue_add_idle(struct tw_event_queue *queue, struct tw_event *e);
 
+/**
+ * @brief add an idle task unless one with the same key is already queued
+ *
+ * If a task with `key` is waiting to run, its event is replaced by `e` instead
+ * of queuing a new one, so a burst of requests like resizing runs the task
+ * only once per loop iteration. The key is usually the object the task works
+ * on.
+ */
+bool
+tw_event_queue_add_idle_once(struct tw_event_queue *queue, const void *key,
+                             struct tw_event *e);
+
+/**
+ * @brief hand an event to the queue from any thread
+ *
+ * This is the only function of the queue which is safe to call from other
+ * threads. The event is pushed on a lock-free list and the loop thread runs
+ * `event->cb` with fd -1 on its next wake up, events from the same thread run
+ * in posting order. The return value of the callback is ignored. Events still
+ * pending when the queue closes are dropped.
+ */
+bool
+tw_event_queue_post(struct tw_event_queue *queue, struct tw_event *event);
+
+/**
+ * @brief run `work` on a worker thread, then `done` on the loop thread
+ *
+ * The workers are spawned on the first call, one per online CPU. `done` may be
+ * NULL. When the queue closes, the running works are waited for and their
+ * `done` still runs, the works not yet started are skipped and get `done` with
+ * `cancelled` set.
+ */
+bool
+tw_event_queue_submit_work(struct tw_event_queue *queue,
+                           void (*work)(void *data),
+                           void (*done)(void *data, bool cancelled),
+                           void *data);
+
+/**
+ * @brief the number of times the loop woke up in the last whole minute
+ *
+ * Always counted, unlike `tw_event_queue_get_stats`.
+ */
+uint32_t
+tw_event_queue_get_wakeups_per_minute(const struct tw_event_queue *queue);
+
+/**
+ * @brief get the loop counters, false if the stats are not built in
+ *
+ * The loop is only instrumented with the `event_stats` build option, there
+ * is no cost otherwise.
+ */
+bool
+tw_event_queue_get_stats(const struct tw_event_queue *queue,
+                         struct tw_event_queue_stats *stats);
+
+/**
+ * @brief get the callback times of the source on `fd`
+ */
+bool
+tw_event_queue_get_source_stats(const struct tw_event_queue *queue, int fd,
+                                struct tw_event_source_stats *stats);
+
+void
+tw_event_queue_dump_stats(const struct tw_event_queue *queue, FILE *file);
+
+/**
+ * @brief dump the stats to `file` every `interval_ms`, a NULL file or 0
+ * interval stops it.
+ */
+bool
+tw_event_queue_set_stats_dump(struct tw_event_queue *queue, FILE *file,
+                              uint32_t interval_ms);
+
+/**
+ * @brief get the allocation counters of the queue
+ *
+ * `sys_allocs` only grows when the queue needs more memory from the system, it
+ * stays the same once the queue reaches its steady state.
+ */
+void
+tw_event_queue_get_alloc_stats(const struct tw_event_queue *queue,
+                               struct tw_event_queue_alloc_stats *stats);
+
 
 #ifdef __cplusplus
 }
@@ -80,7 +80,7 @@ image_cache_from_arrays_filtered(const struct wl_array *handle_array,
 /**
  * @brief image cache file IO reading
  *
- * very slow, could be on another thread
+ * very slow, better run with tw_event_queue_submit_work()
  */
 struct image_cache
 image_cache_from_fd(int fd);
@@ -88,7 +88,7 @@ image_cache_from_fd(int fd);
 /**
  * @brief image cache file IO writing
  *
- * very slow, could be on another thread
+ * very slow, better run with tw_event_queue_submit_work()
  */
 void
 image_cache_to_fd(const struct image_cache *cache, int fd);
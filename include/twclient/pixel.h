@@ -0,0 +1,113 @@
+/*
+ * pixel.h - taiwins client pixel format header
+ *
+ * Copyright (c) 2019-2021 Xichen Zhou
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef TW_PIXEL_H
+#define TW_PIXEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*******************************************************************************
+ * format table
+ *
+ * The wl_shm formats are packed little endian words, a channel is `bits` wide
+ * starting at bit `shift` of the word. Colors are premultiplied by alpha.
+ ******************************************************************************/
+
+struct tw_pixel_channel {
+	uint8_t shift;
+	uint8_t bits; /**< 0 if the format does not have it */
+};
+
+struct tw_shm_format_info {
+	enum wl_shm_format format;
+	uint8_t bpp; /**< bytes per pixel */
+	struct tw_pixel_channel a, r, g, b;
+};
+
+/**
+ * @brief the layout of `format`, NULL if we do not know it
+ */
+const struct tw_shm_format_info *
+tw_shm_format_get_info(enum wl_shm_format format);
+
+static inline bool
+tw_shm_format_has_alpha(const struct tw_shm_format_info *info)
+{
+	return info->a.bits != 0;
+}
+
+/*******************************************************************************
+ * kernels
+ *
+ * Strides are in bytes. Colors given as argb are ARGB8888 premultiplied.
+ ******************************************************************************/
+
+/**
+ * @brief convert a `width` x `height` image between two formats
+ *
+ * Returns false if one of the formats is unknown. Channels missing in the
+ * source read as opaque or 0, channels missing in the destination are dropped.
+ */
+bool
+tw_pixel_convert(void *dst, enum wl_shm_format dst_format, size_t dst_stride,
+                 const void *src, enum wl_shm_format src_format,
+                 size_t src_stride, unsigned int width, unsigned int height);
+
+/**
+ * @brief fill a rectangle of an image with one color
+ */
+bool
+tw_pixel_fill(void *dst, enum wl_shm_format format, size_t stride,
+              unsigned int x, unsigned int y,
+              unsigned int width, unsigned int height, uint32_t argb);
+
+/**
+ * @brief copy a rectangle between two images of the same format
+ */
+bool
+tw_pixel_blit(void *dst, size_t dst_stride, unsigned int dx, unsigned int dy,
+              const void *src, size_t src_stride,
+              unsigned int sx, unsigned int sy,
+              enum wl_shm_format format,
+              unsigned int width, unsigned int height);
+
+/**
+ * @brief `argb` in the pixel layout of `format`
+ */
+uint32_t
+tw_pixel_pack(const struct tw_shm_format_info *info, uint32_t argb);
+
+uint32_t
+tw_pixel_unpack(const struct tw_shm_format_info *info, uint32_t pixel);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* EOF */
@@ -35,6 +35,23 @@ extern "C" {
 #endif
 
 struct anonymous_buff_t;
+struct tw_shm_allocator;
+struct tw_shm_arena;
+
+enum tw_shm_pool_flag {
+	/* hugetlb pages, transparent huge pages when none are reserved */
+	TW_SHM_POOL_HUGEPAGES = 1 << 0,
+	/* fault the pages in when they are mapped, not in the first draw */
+	TW_SHM_POOL_POPULATE = 1 << 1,
+	/* seal the file so it cannot shrink under the compositor */
+	TW_SHM_POOL_SEAL = 1 << 2,
+	/* all of the above for pools of TW_SHM_POOL_LARGE bytes or more */
+	TW_SHM_POOL_AUTO = 1 << 3,
+};
+
+#define TW_SHM_POOL_LARGE (4 * 1024 * 1024)
+#define TW_SHM_POOL_HUGE_PAGE (2 * 1024 * 1024)
+
 /******************************************************************************
  *
  * a wl_buffer managerment solution, using a pool based approach
@@ -46,9 +63,41 @@ struct tw_shm_pool {
 	struct wl_shm_pool *pool;
 	struct wl_list wl_buffers;
 	enum wl_shm_format format;
+	/* free ranges of the file, the space of freed buffers is reused */
+	struct tw_shm_allocator *allocator;
+	/* the flags the file got, AUTO resolved */
+	uint32_t flags;
+	size_t file_align; /**< the page size of the file */
+	struct tw_shm_arena *arena; /**< the arena owning the pool, if any */
 };
 
-int tw_shm_pool_init(struct tw_shm_pool *pool, struct wl_shm *shm, size_t size, enum wl_shm_format format);
+struct tw_shm_pool_stats {
+	size_t size; /**< size of the file */
+	size_t used; /**< bytes held by the buffers */
+	size_t high_water; /**< the most bytes ever held by the buffers */
+	size_t free_ranges; /**< number of holes, the tail included */
+	size_t largest_free; /**< the biggest buffer fitting without growth */
+	/* 0 when the free space is one range, close to 1 when it is scattered
+	 * in small holes */
+	float fragmentation;
+};
+
+/**
+ * @brief create the pool with a file of `size` bytes at least
+ *
+ * Returns the size of the file, 0 on failure.
+ */
+int tw_shm_pool_init(struct tw_shm_pool *pool, struct wl_shm *shm, size_t size,
+                     enum wl_shm_format format);
+
+/**
+ * @brief `tw_shm_pool_init` with `flags` of `tw_shm_pool_flag`
+ *
+ * The flags the system cannot do are dropped.
+ */
+int tw_shm_pool_init_with_flags(struct tw_shm_pool *pool, struct wl_shm *shm,
+                                size_t size, enum wl_shm_format format,
+                                uint32_t flags);
 
 void tw_shm_pool_release(struct tw_shm_pool *pool);
 
@@ -66,6 +115,14 @@ struct wl_buffer *tw_shm_pool_alloc_buffer(struct tw_shm_pool *pool, size_t widt
  */
 struct tw_shm_pool *tw_shm_pool_buffer_free(struct wl_buffer *wl_buffer);
 
+/**
+ * @brief free the buffer and give its pages back to the system
+ *
+ * Unlike `tw_shm_pool_trim`, the rest of the pool is left alone. Returns the
+ * bytes that were resident.
+ */
+size_t tw_shm_pool_buffer_free_and_trim(struct wl_buffer *wl_buffer);
+
 bool tw_shm_pool_release_if_unused(struct tw_shm_pool *pool);
 
 /**
@@ -78,8 +135,95 @@ void tw_shm_pool_set_buffer_release_notify(struct wl_buffer *wl_buffer,
 
 void *tw_shm_pool_buffer_access(struct wl_buffer *wl_buffer);
 
+/**
+ * @brief read the pixels of a buffer without marking it in use, the
+ * compositor may have released it already
+ */
+const void *tw_shm_pool_buffer_peek(struct wl_buffer *wl_buffer);
+
 size_t tw_shm_pool_buffer_size(struct wl_buffer *wl_buffer);
 
+void tw_shm_pool_get_stats(const struct tw_shm_pool *pool,
+                           struct tw_shm_pool_stats *stats);
+
+/**
+ * @brief give the pages of the free space of the pool back to the system
+ *
+ * The file keeps its size, the space reads as zeros when it is used again.
+ * Returns the bytes that were resident.
+ */
+size_t tw_shm_pool_trim(struct tw_shm_pool *pool);
+
+/******************************************************************************
+ *
+ * shm arena, the buffers of many surfaces in a few large pools
+ *
+ *****************************************************************************/
+#define TW_SHM_ARENA_POOL_SIZE (16 * 1024 * 1024)
+
+/* what a user of the arena holds in it */
+struct tw_shm_account {
+	size_t used; /**< bytes of its buffers, page aligned */
+	size_t high_water;
+	uint32_t buffers;
+};
+
+struct tw_shm_arena {
+	struct wl_shm *shm;
+	enum wl_shm_format format;
+	size_t pool_size; /**< the size of a new pool, bigger buffers get
+	                   * their own */
+	struct tw_shm_pool **pools;
+	size_t n_pools;
+};
+
+struct tw_shm_arena_stats {
+	size_t pools;
+	size_t size; /**< of all the files */
+	size_t used;
+};
+
+/**
+ * @brief an arena creating pools of `pool_size`, 0 for
+ * TW_SHM_ARENA_POOL_SIZE
+ */
+void tw_shm_arena_init(struct tw_shm_arena *arena, struct wl_shm *shm,
+                       enum wl_shm_format format, size_t pool_size);
+
+/**
+ * @brief destroy the pools with their buffers, after the users of the arena
+ */
+void tw_shm_arena_release(struct tw_shm_arena *arena);
+
+/**
+ * @brief allocate a buffer from the first pool with the space, charged to
+ * `account`
+ *
+ * The buffer is freed with `tw_shm_pool_buffer_free`, its pool is kept by
+ * the arena.
+ */
+struct wl_buffer *tw_shm_arena_alloc_buffer(struct tw_shm_arena *arena,
+                                            size_t width, size_t height,
+                                            struct tw_shm_account *account);
+
+/**
+ * @brief free every buffer charged to `account`, returns how many
+ *
+ * For a user going away with buffers the compositor still holds, their
+ * release notify would reach it otherwise.
+ */
+uint32_t tw_shm_arena_free_account(struct tw_shm_arena *arena,
+                                   struct tw_shm_account *account);
+
+/**
+ * @brief drop the empty pools and trim the others, returns the resident bytes
+ * given back
+ */
+size_t tw_shm_arena_trim(struct tw_shm_arena *arena);
+
+void tw_shm_arena_get_stats(const struct tw_shm_arena *arena,
+                            struct tw_shm_arena_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
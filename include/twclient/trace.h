@@ -0,0 +1,135 @@
+/*
+ * trace.h - taiwins client event trace header
+ *
+ * Copyright (c) 2019-2021 Xichen Zhou
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef TW_TRACE_H
+#define TW_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct tw_event_queue;
+struct tw_appsurf;
+
+/*******************************************************************************
+ * trace format
+ *
+ * A trace starts with a `tw_trace_header`, followed by records. Every record
+ * is a `tw_trace_record` and `size` bytes of payload. The integers are in the
+ * byte order of the machine recording it.
+ ******************************************************************************/
+
+#define TW_TRACE_MAGIC 0x52545754 /* "TWTR" */
+#define TW_TRACE_VERSION 1
+
+enum tw_trace_kind {
+	TW_TRACE_SOURCE = 1, /**< a source dispatched by the event queue */
+	TW_TRACE_APP_EVENT = 2, /**< a tw_app_event given to a surface */
+};
+
+/* what a dispatched source was */
+enum tw_trace_source_kind {
+	TW_TRACE_SOURCE_GENERAL = 0,
+	TW_TRACE_SOURCE_DISPLAY,
+	TW_TRACE_SOURCE_TIMER,
+	TW_TRACE_SOURCE_FILE,
+	TW_TRACE_SOURCE_DEVICE,
+	TW_TRACE_SOURCE_SIGNAL,
+	TW_TRACE_SOURCE_CHILD,
+	TW_TRACE_SOURCE_POST,
+};
+
+struct tw_trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t start_ns; /**< CLOCK_MONOTONIC when the trace started */
+};
+
+struct tw_trace_record {
+	uint64_t time_ns; /**< since the start of the trace */
+	uint64_t duration_ns; /**< spent in the callback */
+	uint16_t kind;
+	uint16_t subtype; /**< the source kind, or the app event type */
+	int32_t id; /**< fd of the source, or id of the wl_surface */
+	int32_t output; /**< return of the source callback */
+	uint32_t size; /**< bytes of payload following */
+};
+
+/* payload of TW_TRACE_APP_EVENT, followed by `extra` bytes: the clipboard data
+ * or the mime type of a clipboard source */
+struct tw_trace_app_event {
+	uint32_t time;
+	uint32_t args[6]; /**< the fields of the event, in declaration order */
+	uint32_t extra;
+};
+
+/*******************************************************************************
+ * recording and replay
+ ******************************************************************************/
+
+/**
+ * @brief record the dispatched sources and app events of the queue to `path`
+ *
+ * Replaces the running trace if there is one. The trace is buffered, it is
+ * complete after `tw_event_queue_stop_trace` or closing the queue.
+ */
+bool
+tw_event_queue_start_trace(struct tw_event_queue *queue, const char *path);
+
+void
+tw_event_queue_stop_trace(struct tw_event_queue *queue);
+
+enum tw_trace_replay_flag {
+	/* sleep between the events like they were recorded, instead of
+	 * running them back to back */
+	TW_TRACE_REPLAY_TIMED = 1,
+};
+
+struct tw_trace_replay_stats {
+	uint32_t events; /**< app events replayed */
+	uint32_t sources; /**< source records seen */
+	uint64_t recorded_ns; /**< time spent on the events when recorded */
+	uint64_t total_ns; /**< time spent on the events in the replay */
+	uint64_t max_ns; /**< the slowest event in the replay */
+};
+
+/**
+ * @brief feed the app events of a trace to `surf`, no compositor needed
+ *
+ * The events go through the filters and `do_frame` of `surf`, which has to be
+ * able to draw without a wl_surface, a draw path writing to memory for
+ * example. `surface_id` picks the events of one recorded surface, 0 takes all
+ * of them. Returns false if the trace cannot be read.
+ */
+bool
+tw_trace_replay(const char *path, struct tw_appsurf *surf,
+                uint32_t surface_id, uint32_t flags,
+                struct tw_trace_replay_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* EOF */
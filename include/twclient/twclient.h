@@ -22,9 +22,11 @@
 
 #include "client.h"
 #include "shmpool.h"
+#include "pixel.h"
 #include "egl.h"
 #include "nk_backends.h"
 #include "theme.h"
+#include "trace.h"
 
 //auxiliary headers
 #include "image_cache.h"
@@ -35,6 +35,7 @@
 #include <cairo/cairo.h>
 #include <wayland-client.h>
 #include "ui_event.h"
+#include "shmpool.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -113,6 +114,54 @@ tw_make_bbox_origin(uint16_t w, uint16_t h, uint16_t s)
 	return (struct tw_bbox){0, 0, w, h, s};
 }
 
+/*******************************************************************************
+ * damage region
+ ******************************************************************************/
+#define TW_DAMAGE_MAX_RECTS 16
+
+/**
+ * @brief the changed area of a surface, as a few rectangles in surface
+ * coordinates
+ *
+ * The rectangles never contain one another. Adjacent rectangles forming a
+ * rectangle are merged. Past TW_DAMAGE_MAX_RECTS, the pair wasting the least
+ * area is merged.
+ */
+struct tw_damage {
+	struct tw_bbox rects[TW_DAMAGE_MAX_RECTS]; /**< scale is always 1 */
+	unsigned int n;
+};
+
+static inline void
+tw_damage_init(struct tw_damage *damage)
+{
+	damage->n = 0;
+}
+
+static inline bool
+tw_damage_empty(const struct tw_damage *damage)
+{
+	return damage->n == 0;
+}
+
+void
+tw_damage_add(struct tw_damage *damage, int x, int y, int w, int h);
+
+void
+tw_damage_union(struct tw_damage *dst, const struct tw_damage *src);
+
+/**
+ * @brief merge the rectangles until there are at most `max` of them
+ */
+void
+tw_damage_simplify(struct tw_damage *damage, unsigned int max);
+
+/**
+ * @brief the bounding box of the damage
+ */
+struct tw_bbox
+tw_damage_extents(const struct tw_damage *damage);
+
 /*******************************************************************************
  * app surface
  ******************************************************************************/
@@ -120,6 +169,9 @@ struct tw_globals;
 struct tw_appsurf;
 struct tw_egl_env;
 struct tw_shm_pool;
+struct tw_shm_render;
+
+#define TW_SHM_MAX_BUFFERS 4
 
 enum tw_appsurf_type {
 	TW_APPSURF_BACKGROUND,
@@ -197,9 +249,47 @@ struct tw_appsurf {
 	union {
 		struct {
 			struct tw_shm_pool *pool;
-			struct wl_buffer  *wl_buffer[2];
-			bool dirty[2];
-			bool committed[2];
+			struct wl_buffer  *wl_buffer[TW_SHM_MAX_BUFFERS];
+			bool dirty[TW_SHM_MAX_BUFFERS];
+			bool committed[TW_SHM_MAX_BUFFERS];
+			/* the swapchain starts with 2 buffers, and gets one
+			 * more every time the compositor holds all of them,
+			 * up to max_buffers */
+			unsigned int n_buffers, max_buffers;
+			uint32_t stalls; /**< frames finding no free buffer */
+			uint32_t drops; /**< frames drawn late because of it */
+			bool frame_pending; /**< draw once a buffer returns */
+			/* the draw call adds what it changed here, it is
+			 * empty when the call starts */
+			struct tw_damage damage;
+			/* frames since the buffer given to the draw call was
+			 * drawn, 1 is the last frame, 0 is unknown content */
+			unsigned int buffer_age;
+			/* copy what the buffer misses from the last frame
+			 * before the draw call, making buffer_age 1 */
+			bool copy_forward;
+			uint32_t frame_seq;
+			uint32_t buffer_frame[TW_SHM_MAX_BUFFERS];
+			/* damage of the last frames, by frame_seq */
+			struct tw_damage history[TW_SHM_MAX_BUFFERS];
+			/* replaces the pool by a tight one once the size
+			 * stops changing */
+			struct tw_event_timer *shrink_timer;
+			/* drops the buffers the compositor does not hold
+			 * after trim_delay ms without a frame, 0 never */
+			struct tw_event_timer *trim_timer;
+			uint32_t trim_delay;
+			uint32_t trims;
+			uint64_t trimmed_bytes; /**< resident bytes given back */
+			/* the shm arena of tw_globals when the surface was
+			 * created, NULL for a pool of its own */
+			struct tw_shm_arena *arena;
+			/* what the surface holds in the arena */
+			struct tw_shm_account shm_account;
+			/* draw on a worker of the event queue, the buffer
+			 * being drawn stays dirty until the loop commits it */
+			bool threaded;
+			struct tw_shm_render *render;
 			//add pixman_region to accumelate the damage
 		};
 		struct {
@@ -319,6 +409,10 @@ tw_appsurf_clean_egl(struct tw_appsurf *surf, struct tw_egl_env *env);
  * to allocate new memory, since you won't have extra space for ther other
  * user_data, expecting to embend tw_appsurf in another data structure.
  *
+ * `geo` starts as the whole surface and is the damage of the frame, unless the
+ * call adds finer damage to `surf->damage` with `tw_damage_add`. Drawing only
+ * the damage is correct if `surf->buffer_age` is 1, with copy forward the
+ * buffer is brought up to date by then.
  */
 typedef void (*tw_shm_buffer_draw_t)(struct tw_appsurf *surf,
                                      struct wl_buffer *buffer,
@@ -332,10 +426,62 @@ tw_shm_buffer_impl_app_surface(struct tw_appsurf *surf,
 /**
  * @brief we can expose part of shm_buffer implementation for any shm_pool
  * double buffer based implementation
+ *
+ * The buffers are re-created in the pool of the surface, which grows as
+ * needed. It is replaced by a smaller one after the size is stable for
+ * `TW_SHM_SHRINK_DELAY` ms.
  */
 bool
 tw_shm_buffer_reallocate(struct tw_appsurf *surf, const struct tw_bbox *geo);
 
+/**
+ * @brief cap the swapchain of a shm surface to `max` buffers, 2 to
+ * TW_SHM_MAX_BUFFERS
+ *
+ * 2 is plain double buffering. The buffers already allocated stay.
+ */
+void
+tw_shm_buffer_set_max_buffers(struct tw_appsurf *surf, unsigned int max);
+
+/**
+ * @brief let the shm surface copy the missing damage of the previous frames
+ * into the buffer before drawing
+ *
+ * For draw calls repainting only what changed. The copy comes from the buffer
+ * of the last frame, the whole surface is copied when the history is lost.
+ */
+void
+tw_shm_buffer_set_copy_forward(struct tw_appsurf *surf, bool enable);
+
+#define TW_SHM_SHRINK_DELAY 1000
+
+/**
+ * @brief free the memory of a shm surface after `delay` ms without a frame, 0
+ * turns it off
+ *
+ * The buffers not held by the compositor are freed and the pages of the pool
+ * punched out, the next frame allocates them again. In a shm arena only the
+ * pages of those buffers go, the empty pools are left to `tw_shm_arena_trim`.
+ * Panels and lockers start with TW_SHM_TRIM_DELAY.
+ */
+void
+tw_shm_buffer_set_idle_trim(struct tw_appsurf *surf, uint32_t delay);
+
+#define TW_SHM_TRIM_DELAY 10000
+
+/**
+ * @brief draw the frames of a shm surface on a worker thread
+ *
+ * The draw call then runs off the loop thread with one frame in flight, the
+ * attach, damage and commit still happen on the loop thread once it returns.
+ * The call may only touch the buffer, `geo` and `surf->damage`, the rest of
+ * the surface and the wayland objects belong to the loop thread. Frames asked
+ * for while drawing are merged into one drawn after it. A frame the queue
+ * cannot hand to a worker is drawn in place.
+ */
+bool
+tw_shm_buffer_set_threaded(struct tw_appsurf *surf, bool enable);
+
 void
 tw_shm_buffer_resize(struct tw_appsurf *surf, const struct tw_app_event *e);
 
@@ -20,13 +20,20 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <ctypes/helpers.h>
 #include <twclient/client.h>
 #include <twclient/ui.h>
 #include <twclient/egl.h>
+#include <twclient/pixel.h>
 #include <twclient/shmpool.h>
 #include <wayland-client-protocol.h>
 
+#include "internal.h"
+
 WL_EXPORT void
 tw_appsurf_init_egl(struct tw_appsurf *surf, struct tw_egl_env *env)
 {
@@ -94,8 +101,8 @@ tw_appsurf_release(struct tw_appsurf *surf)
 	wl_list_init(&surf->filter_head);
 }
 
-void
-_tw_appsurf_run_frame(struct tw_appsurf *surf, const struct tw_app_event *e)
+static void
+appsurf_run_frame(struct tw_appsurf *surf, const struct tw_app_event *e)
 {
 	struct tw_app_event_filter *f;
 	wl_list_for_each(f, &surf->filter_head, link) {
@@ -106,6 +113,28 @@ _tw_appsurf_run_frame(struct tw_appsurf *surf, const struct tw_app_event *e)
 	surf->do_frame(surf, e);
 }
 
+void
+_tw_appsurf_run_frame(struct tw_appsurf *surf, const struct tw_app_event *e)
+{
+	struct tw_globals *globals = surf->tw_globals;
+	struct tw_event_trace *trace = globals ?
+		globals->event_queue.trace : NULL;
+	uint32_t id;
+	uint64_t start;
+
+	if (!trace) {
+		appsurf_run_frame(surf, e);
+		return;
+	}
+	id = surf->wl_surface ?
+		wl_proxy_get_id((struct wl_proxy *)surf->wl_surface) : 0;
+	start = _tw_trace_app_event_begin(trace);
+	appsurf_run_frame(surf, e);
+	//the trace may be stopped in the middle
+	if (globals->event_queue.trace == trace)
+		_tw_trace_app_event_end(trace, id, e, start);
+}
+
 WL_EXPORT void
 tw_appsurf_frame(struct tw_appsurf *surf, bool anime)
 {
@@ -211,9 +240,165 @@ tw_appsurf_request_frame_event(struct tw_appsurf *surf,
 	                         container);
 }
 
+/******************************************************************************
+ * damage region
+ *****************************************************************************/
+
+static inline unsigned long
+damage_rect_area(const struct tw_bbox *r)
+{
+	return (unsigned long)r->w * r->h;
+}
+
+static inline bool
+damage_rect_contains(const struct tw_bbox *a, const struct tw_bbox *b)
+{
+	return a->x <= b->x && a->y <= b->y &&
+		a->x + a->w >= b->x + b->w &&
+		a->y + a->h >= b->y + b->h;
+}
+
+static inline struct tw_bbox
+damage_rect_union(const struct tw_bbox *a, const struct tw_bbox *b)
+{
+	int x0 = MIN(a->x, b->x), y0 = MIN(a->y, b->y);
+	int x1 = MAX(a->x + a->w, b->x + b->w);
+	int y1 = MAX(a->y + a->h, b->y + b->h);
+
+	return tw_make_bbox(x0, y0, x1 - x0, y1 - y0, 1);
+}
+
+static inline unsigned long
+damage_rect_overlap(const struct tw_bbox *a, const struct tw_bbox *b)
+{
+	int w = MIN(a->x + a->w, b->x + b->w) - MAX(a->x, b->x);
+	int h = MIN(a->y + a->h, b->y + b->h) - MAX(a->y, b->y);
+
+	return (w > 0 && h > 0) ? (unsigned long)w * h : 0;
+}
+
+/* the area merging a and b paints for nothing */
+static inline unsigned long
+damage_merge_cost(const struct tw_bbox *a, const struct tw_bbox *b)
+{
+	struct tw_bbox u = damage_rect_union(a, b);
+
+	return damage_rect_area(&u) + damage_rect_overlap(a, b) -
+		damage_rect_area(a) - damage_rect_area(b);
+}
+
+static inline void
+damage_remove(struct tw_damage *damage, unsigned int i)
+{
+	damage->rects[i] = damage->rects[--damage->n];
+}
+
+static void
+damage_insert(struct tw_damage *damage, struct tw_bbox r)
+{
+	unsigned int i = 0;
+
+	while (i < damage->n) {
+		struct tw_bbox *o = &damage->rects[i];
+
+		if (damage_rect_contains(o, &r))
+			return;
+		if (damage_rect_contains(&r, o)) {
+			damage_remove(damage, i);
+		} else if (!damage_merge_cost(o, &r)) {
+			//they form a rectangle, start over with it
+			r = damage_rect_union(o, &r);
+			damage_remove(damage, i);
+			i = 0;
+		} else {
+			i++;
+		}
+	}
+	if (damage->n == TW_DAMAGE_MAX_RECTS)
+		tw_damage_simplify(damage, TW_DAMAGE_MAX_RECTS - 1);
+	damage->rects[damage->n++] = r;
+}
+
+WL_EXPORT void
+tw_damage_add(struct tw_damage *damage, int x, int y, int w, int h)
+{
+	int x1 = MIN(x + w, UINT16_MAX), y1 = MIN(y + h, UINT16_MAX);
+
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+	if (x1 <= x || y1 <= y)
+		return;
+	damage_insert(damage, tw_make_bbox(x, y, x1 - x, y1 - y, 1));
+}
+
+WL_EXPORT void
+tw_damage_union(struct tw_damage *dst, const struct tw_damage *src)
+{
+	for (unsigned int i = 0; i < src->n; i++)
+		damage_insert(dst, src->rects[i]);
+}
+
+WL_EXPORT void
+tw_damage_simplify(struct tw_damage *damage, unsigned int max)
+{
+	max = MAX(max, 1);
+	while (damage->n > max) {
+		unsigned long cost, best = ULONG_MAX;
+		unsigned int bi = 0, bj = 1;
+
+		for (unsigned int i = 0; i < damage->n; i++)
+			for (unsigned int j = i + 1; j < damage->n; j++) {
+				cost = damage_merge_cost(&damage->rects[i],
+				                         &damage->rects[j]);
+				if (cost < best) {
+					best = cost;
+					bi = i;
+					bj = j;
+				}
+			}
+		damage->rects[bi] = damage_rect_union(&damage->rects[bi],
+		                                      &damage->rects[bj]);
+		damage_remove(damage, bj);
+	}
+}
+
+WL_EXPORT struct tw_bbox
+tw_damage_extents(const struct tw_damage *damage)
+{
+	struct tw_bbox box = tw_make_bbox(0, 0, 0, 0, 1);
+
+	if (damage->n)
+		box = damage->rects[0];
+	for (unsigned int i = 1; i < damage->n; i++)
+		box = damage_rect_union(&box, &damage->rects[i]);
+	return box;
+}
+
 /******************************************************************************
  * shm_buffer_impl_surface
  *****************************************************************************/
+static void
+shm_buffer_schedule_trim(struct tw_appsurf *surf);
+
+/* the frame drawn on a worker, it outlives the surface destroyed while
+ * drawing and is freed by shm_render_done then */
+struct tw_shm_render {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct tw_appsurf *surf; /**< NULL once the surface is gone */
+	bool drawing; /**< the worker is in the draw call */
+	bool busy; /**< submitted and shm_render_done not run yet */
+	tw_shm_buffer_draw_t draw_cb;
+	unsigned int index;
+	struct tw_bbox damage;
+};
+
+static inline bool
+shm_render_busy(const struct tw_appsurf *surf)
+{
+	return surf->render && surf->render->busy;
+}
+
 /**
  * @brief smartly release the buffer and pool.
  *
@@ -229,7 +414,7 @@ shm_wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
 	struct tw_appsurf *surf = (struct tw_appsurf *)data;
 	struct tw_shm_pool *pool = NULL;
 	bool inuse = false;
-	for (int i = 0; i < 2; i++)
+	for (unsigned int i = 0; i < surf->n_buffers; i++)
 		if (surf->wl_buffer[i] == wl_buffer) {
 			inuse = true;
 			surf->dirty[i] = false;
@@ -238,31 +423,199 @@ shm_wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
 		}
 	if (!inuse) {
 		pool = tw_shm_pool_buffer_free(wl_buffer);
-		if (tw_shm_pool_release_if_unused(pool))
+		//the pool of the surface keeps the space for the next buffers
+		if (pool != surf->pool && tw_shm_pool_release_if_unused(pool))
 			free(pool);
+	} else if (surf->frame_pending) {
+		//the frame we could not draw
+		surf->frame_pending = false;
+		tw_appsurf_frame(surf, surf->need_animation);
+	} else if (!surf->trim_timer) {
+		//returned after the trim, the buffer is idle as well
+		shm_buffer_schedule_trim(surf);
 	}
 }
 
-/* setup the pool and buffer, destroy the previous pool if there is
- */
-WL_EXPORT bool
-tw_shm_buffer_reallocate(struct tw_appsurf *surf, const struct tw_bbox *geo)
+static inline size_t
+shm_buffer_bytes(struct tw_appsurf *surf, const struct tw_bbox *geo)
+{
+	return tw_bbox_area(geo) *
+		tw_stride_of_wl_shm_format(surf->tw_globals->buffer_format);
+}
+
+static bool
+shm_buffer_alloc_buffer(struct tw_appsurf *surf, unsigned int i,
+                        const struct tw_bbox *geo)
+{
+	surf->wl_buffer[i] = surf->arena ?
+		tw_shm_arena_alloc_buffer(surf->arena, geo->w * geo->s,
+		                          geo->h * geo->s, &surf->shm_account) :
+		tw_shm_pool_alloc_buffer(surf->pool, geo->w * geo->s,
+		                         geo->h * geo->s);
+	surf->dirty[i] = false;
+	surf->committed[i] = false;
+	surf->buffer_frame[i] = 0;
+	if (!surf->wl_buffer[i])
+		return false;
+	tw_shm_pool_set_buffer_release_notify(surf->wl_buffer[i],
+	                                      shm_wl_buffer_release, surf);
+	return true;
+}
+
+static bool
+shm_buffer_alloc_buffers(struct tw_appsurf *surf, const struct tw_bbox *geo)
+{
+	for (unsigned int i = 0; i < surf->n_buffers; i++)
+		if (!shm_buffer_alloc_buffer(surf, i, geo))
+			return false;
+	return true;
+}
+
+/* a new pool just big enough, the previous one goes away once the compositor
+ * returns its buffers */
+static bool
+shm_pool_replace(struct tw_appsurf *surf, const struct tw_bbox *geo)
 {
+	struct tw_shm_pool *pool = calloc(1, sizeof(struct tw_shm_pool));
+
+	if (!pool ||
+	    !tw_shm_pool_init_with_flags(pool, surf->tw_globals->shm,
+	                                 shm_buffer_bytes(surf, geo) *
+	                                 surf->n_buffers,
+	                                 surf->tw_globals->buffer_format,
+	                                 TW_SHM_POOL_AUTO)) {
+		free(pool);
+		return false;
+	}
 	if (surf->pool && tw_shm_pool_release_if_unused(surf->pool))
 		free(surf->pool);
-	surf->pool = calloc(1, sizeof(struct tw_shm_pool));
-	if (!tw_shm_pool_init(surf->pool, surf->tw_globals->shm,
-	                      tw_bbox_area(geo) * 2,
-	                      surf->tw_globals->buffer_format))
-		return false;
-	for (int i = 0; i < 2; i++) {
-		surf->wl_buffer[i] = tw_shm_pool_alloc_buffer(
-			surf->pool, geo->w * geo->s, geo->h * geo->s);
-		surf->dirty[i] = NULL;
-		surf->committed[i] = NULL;
-		tw_shm_pool_set_buffer_release_notify(surf->wl_buffer[i],
-						   shm_wl_buffer_release, surf);
+	surf->pool = pool;
+	return shm_buffer_alloc_buffers(surf, geo);
+}
+
+/* create the buffers in place, the buffers held by the compositor are freed
+ * in shm_wl_buffer_release */
+static bool
+shm_pool_reuse(struct tw_appsurf *surf, const struct tw_bbox *geo)
+{
+	for (unsigned int i = 0; i < surf->n_buffers; i++) {
+		if (surf->wl_buffer[i] && !surf->committed[i])
+			tw_shm_pool_buffer_free(surf->wl_buffer[i]);
+		surf->wl_buffer[i] = NULL;
+	}
+	return shm_buffer_alloc_buffers(surf, geo);
+}
+
+static void
+shm_pool_schedule_shrink(struct tw_appsurf *surf);
+
+static int
+shm_pool_shrink_timeout(struct tw_event *e, int fd)
+{
+	struct tw_appsurf *surf = e->data;
+	struct tw_shm_pool_stats stats;
+
+	surf->shrink_timer = NULL;
+	//the pool may move when replaced, not under the worker
+	if (shm_render_busy(surf)) {
+		shm_pool_schedule_shrink(surf);
+		return TW_EVENT_DEL;
 	}
+	tw_shm_pool_get_stats(surf->pool, &stats);
+	//more than twice of what we need
+	if (stats.size > shm_buffer_bytes(surf, &surf->allocation) *
+	    surf->n_buffers * 2 &&
+	    shm_pool_replace(surf, &surf->allocation))
+		tw_appsurf_frame(surf, surf->need_animation);
+	return TW_EVENT_DEL;
+}
+
+static void
+shm_pool_schedule_shrink(struct tw_appsurf *surf)
+{
+	struct tw_event_queue *queue = &surf->tw_globals->event_queue;
+	struct itimerspec spec = {
+		.it_value = {
+			.tv_sec = TW_SHM_SHRINK_DELAY / 1000,
+			.tv_nsec = (TW_SHM_SHRINK_DELAY % 1000) * 1000000,
+		},
+	};
+	struct tw_event e = {
+		.data = surf,
+		.cb = shm_pool_shrink_timeout,
+	};
+
+	if (surf->shrink_timer)
+		tw_event_queue_rearm_timer(queue, surf->shrink_timer, &spec);
+	else
+		surf->shrink_timer =
+			tw_event_queue_start_timer(queue, &spec, &e);
+}
+
+static int
+shm_buffer_trim_timeout(struct tw_event *e, int fd)
+{
+	struct tw_appsurf *surf = e->data;
+	size_t trimmed = 0;
+
+	surf->trim_timer = NULL;
+	for (unsigned int i = 0; i < surf->n_buffers; i++) {
+		if (!surf->wl_buffer[i] || surf->committed[i] ||
+		    surf->dirty[i])
+			continue;
+		//the arena is shared, only the space we had goes
+		if (surf->pool)
+			tw_shm_pool_buffer_free(surf->wl_buffer[i]);
+		else
+			trimmed += tw_shm_pool_buffer_free_and_trim(
+				surf->wl_buffer[i]);
+		surf->wl_buffer[i] = NULL;
+		surf->dirty[i] = false;
+		surf->buffer_frame[i] = 0;
+	}
+	if (surf->pool)
+		trimmed = tw_shm_pool_trim(surf->pool);
+	surf->trimmed_bytes += trimmed;
+	surf->trims++;
+	return TW_EVENT_DEL;
+}
+
+static void
+shm_buffer_schedule_trim(struct tw_appsurf *surf)
+{
+	struct tw_event_queue *queue = &surf->tw_globals->event_queue;
+	struct itimerspec spec = {
+		.it_value = {
+			.tv_sec = surf->trim_delay / 1000,
+			.tv_nsec = (surf->trim_delay % 1000) * 1000000,
+		},
+	};
+	struct tw_event e = {
+		.data = surf,
+		.cb = shm_buffer_trim_timeout,
+	};
+
+	if (!surf->trim_delay)
+		return;
+	if (surf->trim_timer)
+		tw_event_queue_rearm_timer(queue, surf->trim_timer, &spec);
+	else
+		surf->trim_timer =
+			tw_event_queue_start_timer(queue, &spec, &e);
+}
+
+/* setup the pool and buffer, the pool is reused across resizes and grows
+ * geometrically */
+WL_EXPORT bool
+tw_shm_buffer_reallocate(struct tw_appsurf *surf, const struct tw_bbox *geo)
+{
+	if (!surf->pool && !surf->arena)
+		return shm_pool_replace(surf, geo);
+	if (!shm_pool_reuse(surf, geo))
+		return false;
+	//the arena is shared, not ours to shrink
+	if (surf->pool)
+		shm_pool_schedule_shrink(surf);
 	return true;
 }
 
@@ -276,6 +629,9 @@ shm_pool_resize_idle(struct tw_event *e, int fd)
 	    surf->pending_allocation.h == surf->allocation.h &&
 	    surf->pending_allocation.s == surf->allocation.s)
 		return TW_EVENT_DEL;
+	//shm_render_done queues it again
+	if (shm_render_busy(surf))
+		return TW_EVENT_DEL;
 
 	if (!tw_shm_buffer_reallocate(surf, geo))
 		return TW_EVENT_DEL;
@@ -288,17 +644,275 @@ shm_pool_resize_idle(struct tw_event *e, int fd)
 	return TW_EVENT_DEL;
 }
 
+static void
+shm_pool_queue_resize(struct tw_appsurf *surf)
+{
+	struct tw_event re = {
+		.data = surf,
+		.cb = shm_pool_resize_idle,
+	};
+	//one reallocation for a burst of resizes
+	tw_event_queue_add_idle_once(&surf->tw_globals->event_queue, surf,
+	                             &re);
+}
+
 WL_EXPORT void
 tw_shm_buffer_resize(struct tw_appsurf *surf, const struct tw_app_event *e)
 {
 	surf->pending_allocation.w = e->resize.nw;
 	surf->pending_allocation.h = e->resize.nh;
 	surf->pending_allocation.s = e->resize.ns;
-	struct tw_event re = {
-		.data = surf,
-		.cb = shm_pool_resize_idle,
-	};
-	tw_event_queue_add_idle(&surf->tw_globals->event_queue, &re);
+	shm_pool_queue_resize(surf);
+}
+
+/* frames since buffer i was drawn, 0 if we do not have the damage since */
+static unsigned int
+shm_buffer_age(struct tw_appsurf *surf, unsigned int i)
+{
+	uint32_t age = surf->frame_seq + 1 - surf->buffer_frame[i];
+
+	if (!surf->buffer_frame[i] || age > TW_SHM_MAX_BUFFERS)
+		return 0;
+	return age;
+}
+
+static void
+shm_buffer_copy_rect(struct tw_appsurf *surf, char *dst, const char *src,
+                     const struct tw_bbox *r)
+{
+	enum wl_shm_format format = surf->tw_globals->buffer_format;
+	unsigned int s = surf->allocation.s;
+	unsigned int x1 = MIN(r->x + r->w, surf->allocation.w);
+	unsigned int y1 = MIN(r->y + r->h, surf->allocation.h);
+	size_t stride = (size_t)surf->allocation.w * s *
+		tw_stride_of_wl_shm_format(format);
+
+	if (x1 <= r->x || y1 <= r->y)
+		return;
+	tw_pixel_blit(dst, stride, r->x * s, r->y * s,
+	              src, stride, r->x * s, r->y * s, format,
+	              (x1 - r->x) * s, (y1 - r->y) * s);
+}
+
+/* bring buffer i up to the last frame, from the buffer which drew it */
+static void
+shm_buffer_copy_forward(struct tw_appsurf *surf, unsigned int i)
+{
+	struct tw_damage missing;
+	unsigned int last;
+	const char *src;
+	char *dst;
+
+	for (last = 0; last < surf->n_buffers; last++)
+		if (surf->wl_buffer[last] && surf->frame_seq &&
+		    surf->buffer_frame[last] == surf->frame_seq)
+			break;
+	if (last == surf->n_buffers || last == i)
+		return;
+
+	tw_damage_init(&missing);
+	if (!surf->buffer_age)
+		tw_damage_add(&missing, 0, 0, surf->allocation.w,
+		              surf->allocation.h);
+	for (uint32_t seq = surf->frame_seq + 2 - surf->buffer_age;
+	     surf->buffer_age && seq <= surf->frame_seq; seq++)
+		tw_damage_union(&missing,
+		                &surf->history[seq % TW_SHM_MAX_BUFFERS]);
+
+	dst = tw_shm_pool_buffer_access(surf->wl_buffer[i]);
+	//the compositor may be done with it, only read
+	src = tw_shm_pool_buffer_peek(surf->wl_buffer[last]);
+	for (unsigned int j = 0; j < missing.n; j++)
+		shm_buffer_copy_rect(surf, dst, src, &missing.rects[j]);
+	surf->buffer_age = 1;
+}
+
+static void
+shm_buffer_submit_damage(struct tw_appsurf *surf)
+{
+	const struct tw_bbox *r;
+	int s = surf->allocation.s;
+	bool by_buffer = wl_surface_get_version(surf->wl_surface) >=
+		WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION;
+
+	for (unsigned int i = 0; i < surf->damage.n; i++) {
+		r = &surf->damage.rects[i];
+		if (by_buffer)
+			wl_surface_damage_buffer(surf->wl_surface,
+			                         r->x * s, r->y * s,
+			                         r->w * s, r->h * s);
+		else
+			wl_surface_damage(surf->wl_surface,
+			                  r->x, r->y, r->w, r->h);
+	}
+}
+
+/* take a free buffer and bring it up to date for the draw call, -1 if the
+ * compositor holds all of them. The buffer stays dirty until committed */
+static int
+shm_buffer_begin_frame(struct tw_appsurf *surf, struct tw_bbox *damage)
+{
+	unsigned int i;
+
+	for (i = 0; i < surf->n_buffers; i++) {
+		if (surf->committed[i] || surf->dirty[i])
+			continue;
+		//trimmed while idle
+		if (!surf->wl_buffer[i] &&
+		    !shm_buffer_alloc_buffer(surf, i, &surf->allocation))
+			continue;
+		break;
+	}
+	//the compositor holds all of them, grow the swapchain if we can,
+	//otherwise draw when one comes back
+	if (i == surf->n_buffers) {
+		surf->stalls++;
+		if (surf->n_buffers < surf->max_buffers &&
+		    shm_buffer_alloc_buffer(surf, surf->n_buffers,
+		                            &surf->allocation)) {
+			surf->n_buffers++;
+		} else {
+			surf->drops++;
+			surf->frame_pending = true;
+			return -1;
+		}
+	}
+	surf->dirty[i] = true;
+	*damage = tw_make_bbox_origin(surf->allocation.w,
+	                              surf->allocation.h, 1);
+	tw_damage_init(&surf->damage);
+	surf->buffer_age = shm_buffer_age(surf, i);
+	if (surf->copy_forward && surf->buffer_age != 1)
+		shm_buffer_copy_forward(surf, i);
+	return i;
+}
+
+static void
+shm_buffer_end_frame(struct tw_appsurf *surf, unsigned int i,
+                     const struct tw_bbox *damage)
+{
+	//also, we should have frame callback here.
+	wl_surface_attach(surf->wl_surface, surf->wl_buffer[i], 0, 0);
+	if (tw_damage_empty(&surf->damage))
+		tw_damage_add(&surf->damage, damage->x, damage->y,
+		              damage->w, damage->h);
+	shm_buffer_submit_damage(surf);
+	//0 stays the mark of a buffer never drawn
+	if (!++surf->frame_seq)
+		surf->frame_seq = 1;
+	surf->history[surf->frame_seq % TW_SHM_MAX_BUFFERS] = surf->damage;
+	surf->buffer_frame[i] = surf->frame_seq;
+	shm_buffer_schedule_trim(surf);
+	//if output has transform, we need to add it here as well.
+	//wl_surface_set_buffer_transform && wl_surface_set_buffer_scale
+	wl_surface_commit(surf->wl_surface);
+	surf->committed[i] = true;
+	surf->dirty[i] = false;
+}
+
+/******************************************************************************
+ * threaded drawing
+ *
+ * The loop thread owns the buffer states. A buffer handed to the worker is
+ * dirty, which keeps the trim, the release and the frames off it, and the
+ * pool is not reallocated until shm_render_done. The worker only touches the
+ * pixels and surf->damage, so the only thing to lock is the surface going
+ * away in the middle of the draw call.
+ *****************************************************************************/
+
+static void
+shm_render_destroy(struct tw_shm_render *render)
+{
+	pthread_cond_destroy(&render->cond);
+	pthread_mutex_destroy(&render->lock);
+	free(render);
+}
+
+static void
+shm_render_work(void *data)
+{
+	struct tw_shm_render *render = data;
+	struct tw_appsurf *surf;
+
+	pthread_mutex_lock(&render->lock);
+	surf = render->surf;
+	render->drawing = surf != NULL;
+	pthread_mutex_unlock(&render->lock);
+	if (!surf)
+		return;
+
+	render->draw_cb(surf, surf->wl_buffer[render->index],
+	                &render->damage);
+
+	pthread_mutex_lock(&render->lock);
+	render->drawing = false;
+	pthread_cond_signal(&render->cond);
+	pthread_mutex_unlock(&render->lock);
+}
+
+static void
+shm_render_done(void *data, bool cancelled)
+{
+	struct tw_shm_render *render = data;
+	struct tw_appsurf *surf = render->surf;
+
+	render->busy = false;
+	if (!surf) {
+		shm_render_destroy(render);
+		return;
+	}
+	if (cancelled)
+		surf->dirty[render->index] = false;
+	else
+		shm_buffer_end_frame(surf, render->index, &render->damage);
+
+	//what came in while drawing, the resize draws a frame as well
+	if (surf->pending_allocation.w != surf->allocation.w ||
+	    surf->pending_allocation.h != surf->allocation.h ||
+	    surf->pending_allocation.s != surf->allocation.s) {
+		surf->frame_pending = false;
+		shm_pool_queue_resize(surf);
+	} else if (surf->frame_pending && !cancelled) {
+		surf->frame_pending = false;
+		tw_appsurf_frame(surf, surf->need_animation);
+	}
+}
+
+static bool
+shm_render_submit(struct tw_appsurf *surf, unsigned int i,
+                  const struct tw_bbox *damage)
+{
+	struct tw_shm_render *render = surf->render;
+
+	render->draw_cb = surf->user_data;
+	render->index = i;
+	render->damage = *damage;
+	render->busy = true;
+	if (!tw_event_queue_submit_work(&surf->tw_globals->event_queue,
+	                                shm_render_work, shm_render_done,
+	                                render)) {
+		render->busy = false;
+		return false;
+	}
+	return true;
+}
+
+/* wait for the draw call, shm_render_done frees it if the work is queued */
+static void
+shm_render_detach(struct tw_appsurf *surf)
+{
+	struct tw_shm_render *render = surf->render;
+
+	pthread_mutex_lock(&render->lock);
+	render->surf = NULL;
+	while (render->drawing)
+		pthread_cond_wait(&render->cond, &render->lock);
+	pthread_mutex_unlock(&render->lock);
+
+	surf->render = NULL;
+	surf->threaded = false;
+	if (!render->busy)
+		shm_render_destroy(render);
 }
 
 static void
@@ -324,43 +938,49 @@ shm_buffer_surface_swap(struct tw_appsurf *surf, const struct tw_app_event *e)
 	}
 	if (ret) return;
 
-	struct wl_buffer *free_buffer = NULL;
 	struct tw_bbox damage;
 	tw_shm_buffer_draw_t draw_cb = surf->user_data;
-	bool *committed; bool *dirty;
+	int i;
 
-	for (int i = 0; i < 2; i++) {
-		if (surf->committed[i] || surf->dirty[i])
-			continue;
-		free_buffer = surf->wl_buffer[i];
-		dirty = &surf->dirty[i];
-		committed = &surf->committed[i];
-		break;
+	//one frame in flight, the next one is drawn after it
+	if (shm_render_busy(surf)) {
+		surf->frame_pending = true;
+		return;
 	}
-	if (!free_buffer) //I should never be here, should I stop in this function?
+	if ((i = shm_buffer_begin_frame(surf, &damage)) < 0)
 		return;
-	*dirty = true;
-	//also, we should have frame callback here.
-	wl_surface_attach(surf->wl_surface, free_buffer, 0, 0);
-	draw_cb(surf, free_buffer, &damage);
-	wl_surface_damage(surf->wl_surface,
-			  damage.x, damage.y, damage.w, damage.h);
-	//if output has transform, we need to add it here as well.
-	//wl_surface_set_buffer_transform && wl_surface_set_buffer_scale
-	wl_surface_commit(surf->wl_surface);
-	*committed = true;
-	*dirty = false;
+	if (surf->threaded && shm_render_submit(surf, i, &damage))
+		return;
+	draw_cb(surf, surf->wl_buffer[i], &damage);
+	shm_buffer_end_frame(surf, i, &damage);
 }
 
 WL_EXPORT void
 tw_shm_buffer_destroy_app_surface(struct tw_appsurf *surf)
 {
-	for (int i = 0; i < 2; i++) {
-		tw_shm_pool_buffer_free(surf->wl_buffer[i]);
+	if (surf->render)
+		shm_render_detach(surf);
+	if (surf->shrink_timer)
+		tw_event_queue_cancel_timer(&surf->tw_globals->event_queue,
+		                            surf->shrink_timer);
+	surf->shrink_timer = NULL;
+	if (surf->trim_timer)
+		tw_event_queue_cancel_timer(&surf->tw_globals->event_queue,
+		                            surf->trim_timer);
+	surf->trim_timer = NULL;
+	for (int i = 0; i < TW_SHM_MAX_BUFFERS; i++) {
+		if (surf->wl_buffer[i])
+			tw_shm_pool_buffer_free(surf->wl_buffer[i]);
+		surf->wl_buffer[i] = NULL;
 		surf->dirty[i] = false;
 		surf->committed[i] = false;
 	}
-	tw_shm_pool_release(surf->pool);
+	//the ones dropped by a resize while the compositor held them
+	if (surf->arena)
+		tw_shm_arena_free_account(surf->arena, &surf->shm_account);
+	surf->arena = NULL;
+	if (surf->pool)
+		tw_shm_pool_release(surf->pool);
 	free(surf->pool);
 	surf->pool = NULL;
 	surf->user_data = NULL;
@@ -375,12 +995,80 @@ tw_shm_buffer_impl_app_surface(struct tw_appsurf *surf,
 	surf->user_data = draw_call;
 	surf->destroy = tw_shm_buffer_destroy_app_surface;
 	surf->pool = NULL;
+	surf->shrink_timer = NULL;
+	surf->n_buffers = 2;
+	surf->max_buffers = TW_SHM_MAX_BUFFERS;
+	surf->stalls = 0;
+	surf->drops = 0;
+	surf->frame_pending = false;
+	surf->buffer_age = 0;
+	surf->copy_forward = false;
+	surf->frame_seq = 0;
+	surf->trim_timer = NULL;
+	surf->trim_delay = (surf->type == TW_APPSURF_PANEL ||
+	                    surf->type == TW_APPSURF_LOCKER) ?
+		TW_SHM_TRIM_DELAY : 0;
+	surf->trims = 0;
+	surf->trimmed_bytes = 0;
+	//one backend for the life of the surface
+	surf->arena = surf->tw_globals->shm_arena;
+	surf->shm_account = (struct tw_shm_account){0};
+	surf->threaded = false;
+	surf->render = NULL;
 	surf->allocation = geo;
 	surf->pending_allocation = geo;
 	wl_surface_set_buffer_scale(surf->wl_surface, geo.s);
 	tw_shm_buffer_reallocate(surf, &geo);
 }
 
+WL_EXPORT void
+tw_shm_buffer_set_max_buffers(struct tw_appsurf *surf, unsigned int max)
+{
+	if (max < 2)
+		max = 2;
+	if (max > TW_SHM_MAX_BUFFERS)
+		max = TW_SHM_MAX_BUFFERS;
+	surf->max_buffers = max;
+}
+
+WL_EXPORT void
+tw_shm_buffer_set_idle_trim(struct tw_appsurf *surf, uint32_t delay)
+{
+	surf->trim_delay = delay;
+	if (!delay && surf->trim_timer) {
+		tw_event_queue_cancel_timer(&surf->tw_globals->event_queue,
+		                            surf->trim_timer);
+		surf->trim_timer = NULL;
+	}
+}
+
+WL_EXPORT void
+tw_shm_buffer_set_copy_forward(struct tw_appsurf *surf, bool enable)
+{
+	surf->copy_forward = enable;
+}
+
+WL_EXPORT bool
+tw_shm_buffer_set_threaded(struct tw_appsurf *surf, bool enable)
+{
+	struct tw_shm_render *render;
+
+	//a frame in flight finishes either way
+	if (!enable || surf->render) {
+		surf->threaded = enable;
+		return true;
+	}
+	render = calloc(1, sizeof(*render));
+	if (!render)
+		return false;
+	pthread_mutex_init(&render->lock, NULL);
+	pthread_cond_init(&render->cond, NULL);
+	render->surf = surf;
+	surf->render = render;
+	surf->threaded = true;
+	return true;
+}
+
 /******************************************************************************
  * embeded_buffer_impl_surface
  *****************************************************************************/
@@ -491,7 +1179,8 @@ tw_eglwin_resize(struct tw_appsurf *surf, const struct tw_app_event *e)
 		.data = surf,
 		.cb = eglwin_resize_idle,
 	};
-	tw_event_queue_add_idle(&surf->tw_globals->event_queue, &re);
+	tw_event_queue_add_idle_once(&surf->tw_globals->event_queue, surf,
+	                             &re);
 }
 
 WL_EXPORT void
@@ -520,7 +1209,11 @@ tw_translate_wl_shm_format(enum wl_shm_format format)
 	case WL_SHM_FORMAT_RGB565:
 		return CAIRO_FORMAT_RGB16_565;
 		break;
+	case WL_SHM_FORMAT_XRGB2101010:
+		return CAIRO_FORMAT_RGB30;
+		break;
 	case WL_SHM_FORMAT_RGBA8888:
+		//cairo has no such layout, draw in ARGB32 and tw_pixel_convert
 		return CAIRO_FORMAT_INVALID;
 		break;
 	default:
@@ -531,22 +1224,8 @@ tw_translate_wl_shm_format(enum wl_shm_format format)
 WL_EXPORT size_t
 tw_stride_of_wl_shm_format(enum wl_shm_format format)
 {
-	switch(format) {
-	case WL_SHM_FORMAT_ARGB8888:
-		return 4;
-		break;
-	case WL_SHM_FORMAT_RGB888:
-		return 3;
-		break;
-	case WL_SHM_FORMAT_RGB565:
-		return 2;
-		break;
-	case WL_SHM_FORMAT_RGBA8888:
-		return 4;
-		break;
-	case WL_SHM_FORMAT_ABGR1555:
-		return 2;
-	default:
-		return 0;
-	}
+	const struct tw_shm_format_info *info =
+		tw_shm_format_get_info(format);
+
+	return info ? info->bpp : 0;
 }
@@ -19,6 +19,9 @@
  *
  */
 
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 
 #include <twclient/client.h>
@@ -32,30 +35,411 @@ struct wl_buffer_node {
 
 	void *addr;
 	off_t offset;
+	size_t size; /**< page aligned, what we took from the pool */
 
 	bool inuse;
 	int width;
 	int height;
 	void *userdata;
 	void (*release)(void *, struct wl_buffer *);
+	struct tw_shm_account *account;
 };
 
+/******************************************************************************
+ * sub-allocator
+ *****************************************************************************/
+
+struct tw_shm_range {
+	off_t offset;
+	size_t size;
+};
+
+struct tw_shm_allocator {
+	/* free ranges sorted by offset, two of them never touch */
+	struct tw_shm_range *ranges;
+	size_t len, cap;
+	size_t used, high_water;
+};
+
+static inline size_t
+shm_page_align(size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	return (size + page - 1) & ~(page - 1);
+}
+
+/* index of the first range starting after `offset` */
+static size_t
+shm_range_lower_bound(const struct tw_shm_allocator *a, off_t offset)
+{
+	size_t lo = 0, hi = a->len;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (a->ranges[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* give back a range, merging it with the neighbours */
+static void
+shm_range_insert(struct tw_shm_allocator *a, off_t offset, size_t size)
+{
+	size_t i = shm_range_lower_bound(a, offset);
+	struct tw_shm_range *prev = i ? &a->ranges[i-1] : NULL;
+	struct tw_shm_range *next = i < a->len ? &a->ranges[i] : NULL;
+	bool merge_prev = prev && prev->offset + (off_t)prev->size == offset;
+	bool merge_next = next && offset + (off_t)size == next->offset;
+
+	if (merge_prev && merge_next) {
+		prev->size += size + next->size;
+		memmove(next, next + 1, (a->len - i - 1) * sizeof(*next));
+		a->len--;
+	} else if (merge_prev) {
+		prev->size += size;
+	} else if (merge_next) {
+		next->offset = offset;
+		next->size += size;
+	} else {
+		if (a->len == a->cap) {
+			size_t cap = a->cap ? a->cap * 2 : 8;
+			struct tw_shm_range *ranges =
+				realloc(a->ranges, cap * sizeof(*ranges));
+			//the range is lost, not the pool
+			if (!ranges)
+				return;
+			a->ranges = ranges;
+			a->cap = cap;
+		}
+		memmove(&a->ranges[i+1], &a->ranges[i],
+		        (a->len - i) * sizeof(*a->ranges));
+		a->ranges[i] = (struct tw_shm_range){offset, size};
+		a->len++;
+	}
+}
+
+/* best fit, we carve from the smallest range `size` fits in */
+static off_t
+shm_range_take(struct tw_shm_allocator *a, size_t size)
+{
+	size_t best = a->len;
+	off_t offset;
+
+	for (size_t i = 0; i < a->len; i++) {
+		if (a->ranges[i].size < size)
+			continue;
+		if (best == a->len || a->ranges[i].size < a->ranges[best].size)
+			best = i;
+		if (a->ranges[i].size == size)
+			break;
+	}
+	if (best == a->len)
+		return -1;
+	offset = a->ranges[best].offset;
+	a->ranges[best].offset += size;
+	a->ranges[best].size -= size;
+	if (!a->ranges[best].size) {
+		memmove(&a->ranges[best], &a->ranges[best+1],
+		        (a->len - best - 1) * sizeof(*a->ranges));
+		a->len--;
+	}
+	return offset;
+}
+
+static int
+tw_shm_pool_resize(struct tw_shm_pool *pool, off_t newsize);
+
+/******************************************************************************
+ * pool file
+ *
+ * Plain pools use the anonymous file of ctypes. With flags, we make the memfd
+ * ourselves, since the pages it is backed with are decided at creation.
+ *****************************************************************************/
+
+/* MFD_HUGE_2MB of linux/memfd.h, which clashes with the glibc defines */
+#ifdef MFD_HUGETLB
+#define SHM_MFD_HUGE_2MB (MFD_HUGETLB | (21U << 26))
+#endif
+
+static inline size_t
+shm_file_align(const struct tw_shm_pool *pool, size_t size)
+{
+	size_t align = pool->file_align;
+
+	return (size + align - 1) & ~(align - 1);
+}
+
+/* fault in the pages of a fresh range, the write does not change them */
+static void
+shm_file_populate(void *addr, size_t size, size_t page)
+{
+#ifdef MADV_POPULATE_WRITE
+	if (!madvise(addr, size, MADV_POPULATE_WRITE))
+		return;
+#endif
+	for (size_t off = 0; off < size; off += page)
+		((volatile char *)addr)[off] = 0;
+}
+
+static void *
+shm_file_map(struct tw_shm_pool *pool, int fd, size_t size)
+{
+	bool thp = (pool->flags & TW_SHM_POOL_HUGEPAGES) &&
+		pool->file_align != TW_SHM_POOL_HUGE_PAGE;
+	int flags = MAP_SHARED;
+	void *addr;
+
+	//THP has to be asked for before the pages come
+	if ((pool->flags & TW_SHM_POOL_POPULATE) && !thp)
+		flags |= MAP_POPULATE;
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+	if (thp) {
+		madvise(addr, size, MADV_HUGEPAGE);
+		if (pool->flags & TW_SHM_POOL_POPULATE)
+			shm_file_populate(addr, size, sysconf(_SC_PAGESIZE));
+	}
+	return addr;
+}
+
+static int
+shm_file_open(struct tw_shm_pool *pool, size_t size, unsigned int mfd_flags)
+{
+	int fd = memfd_create("tw_shm_pool", MFD_CLOEXEC | MFD_ALLOW_SEALING |
+	                      mfd_flags);
+
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, size) < 0)
+		goto err;
+	if (pool->flags & TW_SHM_POOL_SEAL)
+		fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+	pool->file->addr = shm_file_map(pool, fd, size);
+	if (!pool->file->addr)
+		goto err;
+	pool->file->fd = fd;
+	pool->file->size = size;
+	return fd;
+err:
+	close(fd);
+	return -1;
+}
+
+static int
+shm_file_create(struct tw_shm_pool *pool, size_t size)
+{
+	if (!pool->flags)
+		return anonymous_buff_new(pool->file, size,
+		                          PROT_READ | PROT_WRITE, MAP_SHARED);
+#ifdef SHM_MFD_HUGE_2MB
+	//there are often no hugetlb pages reserved, then the mmap fails
+	if (pool->flags & TW_SHM_POOL_HUGEPAGES) {
+		pool->file_align = TW_SHM_POOL_HUGE_PAGE;
+		if (shm_file_open(pool, shm_file_align(pool, size),
+		                  SHM_MFD_HUGE_2MB) >= 0)
+			return pool->file->fd;
+	}
+#endif
+	pool->file_align = sysconf(_SC_PAGESIZE);
+	return shm_file_open(pool, size, 0);
+}
+
+/* remap it whole, mremap does not do hugetlb everywhere */
+static int
+shm_file_resize(struct tw_shm_pool *pool, off_t new_size)
+{
+	struct anonymous_buff_t *file = pool->file;
+	void *addr;
+
+	if (!pool->flags)
+		return anonymous_buff_resize(file, new_size);
+	if (ftruncate(file->fd, new_size) < 0)
+		return -1;
+	addr = shm_file_map(pool, file->fd, new_size);
+	if (!addr)
+		return -1;
+	munmap(file->addr, file->size);
+	file->addr = addr;
+	file->size = new_size;
+	return 0;
+}
+
+/* resident bytes of a range of the mapping */
+static size_t
+shm_file_resident(void *addr, size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE), resident = 0;
+	unsigned char vec[256];
+
+	for (size_t off = 0; off < size; off += sizeof(vec) * page) {
+		size_t len = size - off < sizeof(vec) * page ?
+			size - off : sizeof(vec) * page;
+		if (mincore((char *)addr + off, len, vec) < 0)
+			return 0;
+		for (size_t i = 0; i < (len + page - 1) / page; i++)
+			resident += (vec[i] & 1) ? page : 0;
+	}
+	return resident;
+}
+
+/* drop the pages of a range, it reads as zeros after */
+static size_t
+shm_file_punch(struct tw_shm_pool *pool, off_t offset, size_t size)
+{
+	char *addr = (char *)pool->file->addr + offset;
+	size_t resident = shm_file_resident(addr, size);
+
+	if (fallocate(pool->file->fd,
+	              FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	              offset, size) < 0 &&
+	    madvise(addr, size, MADV_REMOVE) < 0)
+		return 0;
+	return resident;
+}
+
+static void
+shm_file_close(struct tw_shm_pool *pool)
+{
+	if (!pool->flags) {
+		anonymous_buff_close_file(pool->file);
+		return;
+	}
+	munmap(pool->file->addr, pool->file->size);
+	close(pool->file->fd);
+	pool->file->fd = -1;
+}
+
+/* grow the file so `size` fits at the end, the free tail counts. We grow by
+ * half of the file at least, so a growing user does not resize at every
+ * allocation. */
+static bool
+shm_pool_grow(struct tw_shm_pool *pool, size_t size)
+{
+	struct tw_shm_allocator *a = pool->allocator;
+	off_t old_size = pool->file->size;
+	struct tw_shm_range *last = a->len ? &a->ranges[a->len-1] : NULL;
+	size_t tail = (last && last->offset + (off_t)last->size == old_size) ?
+		last->size : 0;
+	size_t grow = shm_file_align(pool, size - tail);
+	size_t half = shm_file_align(pool, old_size / 2);
+	off_t new_size = old_size + (grow > half ? grow : half);
+
+	if (shm_file_resize(pool, new_size) < 0)
+		return false;
+	tw_shm_pool_resize(pool, new_size);
+	shm_range_insert(a, old_size, new_size - old_size);
+	return true;
+}
+
+static void
+shm_buffer_node_destroy(struct wl_buffer_node *node)
+{
+	struct tw_shm_allocator *a = node->pool->allocator;
+
+	wl_buffer_destroy(node->wl_buffer);
+	wl_list_remove(&node->link);
+	if (a) {
+		shm_range_insert(a, node->offset, node->size);
+		a->used -= node->size;
+	}
+	if (node->account) {
+		node->account->used -= node->size;
+		node->account->buffers--;
+	}
+	free(node);
+}
+
+WL_EXPORT void
+tw_shm_pool_get_stats(const struct tw_shm_pool *pool,
+                      struct tw_shm_pool_stats *stats)
+{
+	const struct tw_shm_allocator *a = pool->allocator;
+	size_t free_total = 0;
+
+	*stats = (struct tw_shm_pool_stats){0};
+	if (!a || !pool->file)
+		return;
+	stats->size = pool->file->size;
+	stats->used = a->used;
+	stats->high_water = a->high_water;
+	stats->free_ranges = a->len;
+	for (size_t i = 0; i < a->len; i++) {
+		free_total += a->ranges[i].size;
+		if (a->ranges[i].size > stats->largest_free)
+			stats->largest_free = a->ranges[i].size;
+	}
+	stats->fragmentation = free_total ?
+		1.0f - (float)stats->largest_free / free_total : 0.0f;
+}
+
+WL_EXPORT size_t
+tw_shm_pool_trim(struct tw_shm_pool *pool)
+{
+	const struct tw_shm_allocator *a = pool->allocator;
+	size_t reclaimed = 0;
+
+	if (!a || !pool->file)
+		return 0;
+	//hugetlb files are punched by huge pages
+	for (size_t i = 0; i < a->len; i++) {
+		off_t start = shm_file_align(pool, a->ranges[i].offset);
+		off_t end = (a->ranges[i].offset + a->ranges[i].size) &
+			~(off_t)(pool->file_align - 1);
+		if (end > start)
+			reclaimed += shm_file_punch(pool, start, end - start);
+	}
+	return reclaimed;
+}
+
+/******************************************************************************
+ * pool
+ *****************************************************************************/
+
 WL_EXPORT int
-tw_shm_pool_init(struct tw_shm_pool *pool, struct wl_shm *shm, size_t size,
-	      enum wl_shm_format format)
+tw_shm_pool_init_with_flags(struct tw_shm_pool *pool, struct wl_shm *shm,
+                            size_t size, enum wl_shm_format format,
+                            uint32_t flags)
 {
 	pool->format = format;
 	pool->shm = shm;
+	pool->arena = NULL;
 	wl_list_init(&pool->wl_buffers);
-	pool->file = malloc(sizeof(struct anonymous_buff_t));
-	if (!pool->file)
-		return 0;
-	if (anonymous_buff_new(pool->file, size, PROT_READ | PROT_WRITE, MAP_SHARED) < 0) {
-		return 0;
-	}
+	if ((flags & TW_SHM_POOL_AUTO) && size >= TW_SHM_POOL_LARGE)
+		flags |= TW_SHM_POOL_HUGEPAGES | TW_SHM_POOL_POPULATE |
+			TW_SHM_POOL_SEAL;
+	pool->flags = flags & ~TW_SHM_POOL_AUTO;
+	pool->file_align = sysconf(_SC_PAGESIZE);
+	size = shm_page_align(size);
+	pool->file = calloc(1, sizeof(struct anonymous_buff_t));
+	pool->allocator = calloc(1, sizeof(struct tw_shm_allocator));
+	if (!pool->file || !pool->allocator)
+		goto err;
+	if (shm_file_create(pool, size) < 0)
+		goto err;
+	//hugetlb files are bigger
+	size = pool->file->size;
 	pool->pool = wl_shm_create_pool(shm, pool->file->fd, size);
+	shm_range_insert(pool->allocator, 0, size);
 
 	return size;
+err:
+	free(pool->file);
+	free(pool->allocator);
+	pool->file = NULL;
+	pool->allocator = NULL;
+	return 0;
+}
+
+WL_EXPORT int
+tw_shm_pool_init(struct tw_shm_pool *pool, struct wl_shm *shm, size_t size,
+                 enum wl_shm_format format)
+{
+	return tw_shm_pool_init_with_flags(pool, shm, size, format, 0);
 }
 
 WL_EXPORT void
@@ -68,9 +452,13 @@ tw_shm_pool_release(struct tw_shm_pool *pool)
 		free(v);
 	}
 	wl_shm_pool_destroy(pool->pool);
-	anonymous_buff_close_file(pool->file);
+	shm_file_close(pool);
 	free(pool->file);
 	pool->file = NULL;
+	if (pool->allocator)
+		free(pool->allocator->ranges);
+	free(pool->allocator);
+	pool->allocator = NULL;
 }
 
 static int
@@ -109,59 +497,95 @@ tw_shm_pool_set_buffer_release_notify(struct wl_buffer *wl_buffer,
 }
 
 //the solution here should be actually change the width into width * stride
-WL_EXPORT struct wl_buffer *
-tw_shm_pool_alloc_buffer(struct tw_shm_pool *pool, size_t width, size_t height)
+static struct wl_buffer *
+shm_pool_alloc(struct tw_shm_pool *pool, size_t width, size_t height,
+               bool grow)
 {
 	size_t stride = tw_stride_of_wl_shm_format(pool->format);
-	size_t size = stride * height * width;
+	//buffers start on pages, so they can be dropped page by page
+	size_t size = shm_page_align(stride * height * width);
+	struct tw_shm_allocator *a = pool->allocator;
 
-	int origin_size = pool->file->size;
-	off_t offset = anonymous_buff_alloc_by_offset(pool->file, size);
-	if (pool->file->size > origin_size)
-		tw_shm_pool_resize(pool, pool->file->size);
+	off_t offset = shm_range_take(a, size);
+	if (offset < 0) {
+		if (!grow || !shm_pool_grow(pool, size))
+			return NULL;
+		offset = shm_range_take(a, size);
+	}
+	struct wl_buffer_node *node_buffer = (struct wl_buffer_node *)
+		malloc(sizeof(*node_buffer));
+	if (!node_buffer) {
+		shm_range_insert(a, offset, size);
+		return NULL;
+	}
+	a->used += size;
+	if (a->used > a->high_water)
+		a->high_water = a->used;
 	struct wl_buffer *wl_buffer = wl_shm_pool_create_buffer(pool->pool, offset,
 								width, height,
 								stride * width,
 								pool->format);
-	struct wl_buffer_node *node_buffer = (struct wl_buffer_node *)
-		malloc(sizeof(*node_buffer));
 	wl_list_init(&node_buffer->link);
 	node_buffer->pool = pool;
 	node_buffer->offset = offset;
+	node_buffer->size = size;
 	node_buffer->wl_buffer = wl_buffer;
 	node_buffer->addr = (char *)pool->file->addr + offset;
 	node_buffer->width = width;
 	node_buffer->height = height;
 	node_buffer->inuse = false;
+	node_buffer->userdata = NULL;
+	node_buffer->release = NULL;
+	node_buffer->account = NULL;
 	wl_list_insert(&pool->wl_buffers, &node_buffer->link);
 	wl_buffer_add_listener(wl_buffer, &buffer_listener, node_buffer);
 	return wl_buffer;
 }
 
+WL_EXPORT struct wl_buffer *
+tw_shm_pool_alloc_buffer(struct tw_shm_pool *pool, size_t width, size_t height)
+{
+	return shm_pool_alloc(pool, width, height, true);
+}
+
 WL_EXPORT struct tw_shm_pool *
 tw_shm_pool_buffer_free(struct wl_buffer *wl_buffer)
 {
 	struct wl_buffer_node *node = wl_buffer_get_user_data(wl_buffer);
 	struct tw_shm_pool *pool = node->pool;
 
-	node->inuse = false;
-	wl_buffer_destroy(wl_buffer);
-	wl_list_remove(&node->link);
-	free(node);
-
+	//the space goes back to the pool for the next buffers
+	shm_buffer_node_destroy(node);
 	return pool;
 }
 
+WL_EXPORT size_t
+tw_shm_pool_buffer_free_and_trim(struct wl_buffer *wl_buffer)
+{
+	struct wl_buffer_node *node = wl_buffer_get_user_data(wl_buffer);
+	struct tw_shm_pool *pool = node->pool;
+	//hugetlb files are punched by huge pages
+	off_t start = shm_file_align(pool, node->offset);
+	off_t end = (node->offset + node->size) &
+		~(off_t)(pool->file_align - 1);
+
+	shm_buffer_node_destroy(node);
+	if (!pool->file || end <= start)
+		return 0;
+	return shm_file_punch(pool, start, end - start);
+}
+
 WL_EXPORT bool
 tw_shm_pool_release_if_unused(struct tw_shm_pool *pool)
 {
 	struct wl_buffer_node *node, *tmp;
+
+	//the buffers of other surfaces are in there
+	if (pool->arena)
+		return false;
 	wl_list_for_each_safe(node, tmp, &pool->wl_buffers, link) {
-		if (!node->inuse) {
-			wl_list_remove(&node->link);
-			wl_buffer_destroy(node->wl_buffer);
-			free(node);
-		}
+		if (!node->inuse)
+			shm_buffer_node_destroy(node);
 	}
 	if (wl_list_empty(&pool->wl_buffers)) {
 		tw_shm_pool_release(pool);
@@ -179,6 +603,13 @@ tw_shm_pool_buffer_access(struct wl_buffer *wl_buffer)
 	return node->addr;
 }
 
+WL_EXPORT const void *
+tw_shm_pool_buffer_peek(struct wl_buffer *wl_buffer)
+{
+	struct wl_buffer_node *node = wl_buffer_get_user_data(wl_buffer);
+	return node->addr;
+}
+
 WL_EXPORT size_t
 tw_shm_pool_buffer_size(struct wl_buffer *wl_buffer)
 {
@@ -186,3 +617,146 @@ tw_shm_pool_buffer_size(struct wl_buffer *wl_buffer)
 	size_t stride = tw_stride_of_wl_shm_format(node->pool->format);
 	return node->width * node->height * stride;
 }
+
+/******************************************************************************
+ * arena
+ *****************************************************************************/
+
+WL_EXPORT void
+tw_shm_arena_init(struct tw_shm_arena *arena, struct wl_shm *shm,
+                  enum wl_shm_format format, size_t pool_size)
+{
+	*arena = (struct tw_shm_arena){
+		.shm = shm,
+		.format = format,
+		.pool_size = pool_size ? pool_size : TW_SHM_ARENA_POOL_SIZE,
+	};
+}
+
+static void
+shm_arena_remove_pool(struct tw_shm_arena *arena, size_t i)
+{
+	struct tw_shm_pool *pool = arena->pools[i];
+
+	tw_shm_pool_release(pool);
+	free(pool);
+	memmove(&arena->pools[i], &arena->pools[i+1],
+	        (arena->n_pools - i - 1) * sizeof(*arena->pools));
+	arena->n_pools--;
+}
+
+WL_EXPORT void
+tw_shm_arena_release(struct tw_shm_arena *arena)
+{
+	while (arena->n_pools)
+		shm_arena_remove_pool(arena, arena->n_pools - 1);
+	free(arena->pools);
+	arena->pools = NULL;
+}
+
+static struct tw_shm_pool *
+shm_arena_add_pool(struct tw_shm_arena *arena, size_t size)
+{
+	struct tw_shm_pool **pools, *pool;
+
+	pools = realloc(arena->pools, (arena->n_pools + 1) * sizeof(*pools));
+	if (!pools)
+		return NULL;
+	arena->pools = pools;
+	pool = calloc(1, sizeof(*pool));
+	//no prefault, a popup only faults in the pages it draws to
+	if (!pool ||
+	    !tw_shm_pool_init_with_flags(pool, arena->shm,
+	                                 size > arena->pool_size ?
+	                                 size : arena->pool_size,
+	                                 arena->format, 0)) {
+		free(pool);
+		return NULL;
+	}
+	pool->arena = arena;
+	arena->pools[arena->n_pools++] = pool;
+	return pool;
+}
+
+WL_EXPORT struct wl_buffer *
+tw_shm_arena_alloc_buffer(struct tw_shm_arena *arena, size_t width,
+                          size_t height, struct tw_shm_account *account)
+{
+	struct wl_buffer *wl_buffer = NULL;
+	struct wl_buffer_node *node;
+	struct tw_shm_pool *pool;
+	size_t stride = tw_stride_of_wl_shm_format(arena->format);
+
+	//a new pool rather than growing one, so the others stay mapped
+	for (size_t i = 0; i < arena->n_pools && !wl_buffer; i++)
+		wl_buffer = shm_pool_alloc(arena->pools[i], width, height,
+		                           false);
+	if (!wl_buffer) {
+		pool = shm_arena_add_pool(arena, width * height * stride);
+		if (!pool)
+			return NULL;
+		wl_buffer = shm_pool_alloc(pool, width, height, true);
+		if (!wl_buffer)
+			return NULL;
+	}
+	node = wl_buffer_get_user_data(wl_buffer);
+	node->account = account;
+	if (account) {
+		account->used += node->size;
+		account->buffers++;
+		if (account->used > account->high_water)
+			account->high_water = account->used;
+	}
+	return wl_buffer;
+}
+
+WL_EXPORT uint32_t
+tw_shm_arena_free_account(struct tw_shm_arena *arena,
+                          struct tw_shm_account *account)
+{
+	struct wl_buffer_node *node, *tmp;
+	uint32_t freed = 0;
+
+	for (size_t i = 0; i < arena->n_pools && account->buffers; i++)
+		wl_list_for_each_safe(node, tmp, &arena->pools[i]->wl_buffers,
+		                      link)
+			if (node->account == account) {
+				shm_buffer_node_destroy(node);
+				freed++;
+			}
+	return freed;
+}
+
+WL_EXPORT size_t
+tw_shm_arena_trim(struct tw_shm_arena *arena)
+{
+	size_t reclaimed = 0;
+
+	//the first pool stays for the next popup
+	for (size_t i = arena->n_pools; i-- > 1;)
+		if (wl_list_empty(&arena->pools[i]->wl_buffers)) {
+			reclaimed += shm_file_resident(
+				arena->pools[i]->file->addr,
+				arena->pools[i]->file->size);
+			shm_arena_remove_pool(arena, i);
+		}
+	for (size_t i = 0; i < arena->n_pools; i++)
+		reclaimed += tw_shm_pool_trim(arena->pools[i]);
+	return reclaimed;
+}
+
+WL_EXPORT void
+tw_shm_arena_get_stats(const struct tw_shm_arena *arena,
+                       struct tw_shm_arena_stats *stats)
+{
+	struct tw_shm_pool_stats pool_stats;
+
+	*stats = (struct tw_shm_arena_stats){
+		.pools = arena->n_pools,
+	};
+	for (size_t i = 0; i < arena->n_pools; i++) {
+		tw_shm_pool_get_stats(arena->pools[i], &pool_stats);
+		stats->size += pool_stats.size;
+		stats->used += pool_stats.used;
+	}
+}
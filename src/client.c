@@ -48,7 +48,6 @@
 /*******************************************************************************
  * externs
  ******************************************************************************/
-extern void tw_event_queue_close(struct tw_event_queue *queue);
 extern void tw_keyboard_init(struct wl_keyboard *, struct tw_globals *);
 extern void tw_keyboard_destroy(struct wl_keyboard *);
 
@@ -487,6 +486,21 @@ tw_globals_init(struct tw_globals *globals, struct wl_display *display)
 	globals->inputs.cursor_size = 32;
 }
 
+WL_EXPORT bool
+tw_globals_use_shm_arena(struct tw_globals *globals, size_t pool_size)
+{
+	if (globals->shm_arena)
+		return true;
+	if (!globals->shm || !is_shm_format_valid(globals->buffer_format))
+		return false;
+	globals->shm_arena = malloc(sizeof(struct tw_shm_arena));
+	if (!globals->shm_arena)
+		return false;
+	tw_shm_arena_init(globals->shm_arena, globals->shm,
+	                  globals->buffer_format, pool_size);
+	return true;
+}
+
 WL_EXPORT void
 tw_globals_release(struct tw_globals *globals)
 {
@@ -495,6 +509,12 @@ tw_globals_release(struct tw_globals *globals)
 	wl_shm_destroy(globals->shm);
 	wl_compositor_destroy(globals->compositor);
 	tw_event_queue_close(&globals->event_queue);
+	//last, the buffers of the surfaces are in it
+	if (globals->shm_arena) {
+		tw_shm_arena_release(globals->shm_arena);
+		free(globals->shm_arena);
+		globals->shm_arena = NULL;
+	}
 }
 
 //we need to have a global remove function here
@@ -19,404 +19,3266 @@
  *
  */
 
+#include <stddef.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/epoll.h>
 #include <poll.h>
 #include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <spawn.h>
 #include <libudev.h>
+#if defined(_TW_HAS_IO_URING)
+#include <liburing.h>
+#endif
 
 #include <wayland-client.h>
 #include <wayland-util.h>
 
+#include <ctypes/helpers.h>
 #include <ctypes/sequential.h>
 #include <ctypes/os/buffer.h>
 #include <ctypes/os/file.h>
 #include <twclient/client.h>
+#include <twclient/trace.h>
+
+#include "internal.h"
 
 /*******************************************************************************
  * event queue implemnetaiton
  ******************************************************************************/
+struct tw_uring_op;
+
+/* the most a source reads before its dispatch */
+#define TW_EVENT_READ_MAX 4096
+
 struct tw_event_source {
 	struct wl_list link;
 	struct epoll_event poll_event;
 	struct tw_event event;
-	void (* pre_hook) (struct tw_event_source *);
+	/* the timerfd, eventfd and inotify sources need to be read before the
+	 * dispatch, with io_uring the read is done by the ring. */
+	size_t read_size;
+	void (* on_read) (struct tw_event_source *, const void *data,
+	                  ssize_t len);
 	void (* close)(struct tw_event_source *);
+	struct tw_uring_op *op; /**< request on the ring */
+	/* link in one of the ready lists of the queue */
+	struct wl_list ready_link;
+	enum tw_event_priority priority;
+	enum tw_trace_source_kind kind; /**< what it is in a trace */
+	bool pending_read; /**< ready from the kernel, not drained yet */
+	/* a source removed in its own callback is unlinked right away and
+	 * freed once the callback returns */
+	bool dispatching;
+	bool dead;
+#if defined(_TW_EVENT_STATS)
+	struct tw_event_hist read_time;
+	struct tw_event_hist dispatch_time;
+#endif
 	int fd;//timer, or inotify fd
-	union {
-		int wd;//the actual watch id, we create one inotify per source.
-		struct udev_monitor *mon;
-	};
+};
+
+/* idle tasks only need the callback */
+struct tw_event_idle {
+	struct wl_list link;
+	struct tw_event event;
+	const void *key; /**< only for tasks added by add_idle_once */
+};
+
+/* events posted from other threads */
+struct tw_event_post {
+	struct tw_event_post *next;
+	struct tw_event event;
+};
+
+struct tw_event_mailbox {
+	/** lock-free stack of posts, newest first */
+	_Atomic(struct tw_event_post *) head;
+	int fd; /**< eventfd to wake up epoll_wait */
+};
+
+/* worker pool, every worker owns a deque and steals from the others when it
+ * runs dry */
+#define TW_WORK_MAX_THREADS 16
+
+struct tw_work {
+	struct wl_list link;
+	void (*work)(void *data);
+	void (*done)(void *data, bool cancelled);
+	void *data;
+};
+
+struct tw_work_deque {
+	pthread_mutex_t lock;
+	struct wl_list works; /**< owner takes from the tail, thieves the head */
+};
+
+struct tw_work_worker {
+	struct tw_work_pool *pool;
+	struct tw_work_deque deque;
+	pthread_t thread;
+	unsigned int id;
+};
+
+struct tw_work_pool {
+	struct tw_event_queue *queue;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	atomic_uint pending; /**< submitted and not yet taken */
+	atomic_bool quit;
+	/* finished works waiting for the loop, protected by lock */
+	struct wl_list done;
+	unsigned int next; /**< round robin target of the submissions */
+	unsigned int n_workers;
+	struct tw_work_worker workers[];
+};
+
+/* loop instrumentation, only with _TW_EVENT_STATS */
+struct tw_event_stats {
+	struct tw_event_queue_stats stats;
+	uint64_t start;
+	FILE *dump_file;
+	struct tw_event_timer *dump_timer;
+};
+
+/* file watches, all of them share one inotify fd */
+struct tw_event_watch {
+	int wd;
+	struct tw_event event;
+	/* changes of this round, names are kept as offsets into `names` until
+	 * we deliver them */
+	struct wl_array changes;
+	struct wl_array names;
+	struct wl_list pending_link;
+	bool removed;
+};
+
+struct tw_event_inotify {
+	int fd;
+	/* open addressing map from wd to watches */
+	struct tw_event_watch **slots;
+	size_t cap, len;
+	/* watches with changes to deliver */
+	struct wl_list pending;
+	struct tw_event_watch *current; /**< the one in its callback */
+	bool more; /**< the last read filled the buffer */
+};
+
+/* device watches, demultiplexed from one udev monitor per subsystem */
+struct tw_udev_watch {
+	struct wl_list link;
+	struct tw_event event;
+	int handle;
+	bool removed;
+	size_t devname_len;
+	char devname[];
+};
+
+struct tw_udev_monitor {
+	struct wl_list link;
+	struct tw_event_queue *queue;
+	struct tw_event_source *source;
+	struct udev_monitor *mon;
+	struct wl_list watches;
+	bool dispatching;
+	char *subsystem;
+	char *tag;
+};
+
+struct tw_event_udev {
+	struct wl_list monitors;
+	int next_handle;
+	/* the watch in its callback and the device it gets */
+	struct tw_udev_watch *current;
+	struct udev_device *current_dev;
+};
+
+/* the signals of the queue, all delivered through one signalfd */
+struct tw_event_signals {
+	int fd; /**< -1 until the first signal is added */
+	sigset_t mask;
+	sigset_t blocked; /**< the signals we blocked ourselves */
+	uint64_t pending; /**< bit signo-1 for the signals read */
+	bool more; /**< the last read filled the buffer */
+	struct tw_event events[64];
+	/* the child in its callback */
+	struct tw_event_child *current;
+};
+
+/* a spawned process, watched through its pidfd */
+struct tw_event_child {
+	struct tw_event event;
+	struct tw_event_queue *queue;
+	pid_t pid;
+	int status;
+};
+
+/* open addressing map from keys to queued idle tasks */
+struct tw_event_idle_map {
+	struct tw_event_idle **slots;
+	size_t cap; /**< always power of 2 */
+	size_t len;
+};
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_MAX_DELTA (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+#define TIMER_DISARMED UINT64_MAX
+
+enum tw_event_timer_state {
+	TW_TIMER_DETACHED,
+	TW_TIMER_ON_WHEEL,
+	TW_TIMER_EXPIRED, /**< moved to the expired list, waiting to fire */
+};
+
+struct tw_event_timer {
+	struct wl_list link;
+	struct tw_event event;
+	uint64_t expire; /**< in milliseconds of CLOCK_MONOTONIC */
+	uint64_t deadline; /**< expire before applying the slack */
+	uint64_t interval;
+	uint32_t slack;
+	enum tw_event_timer_state state;
+	int level;
+	bool firing, cancelled;
+};
+
+struct tw_event_timer_wheel {
+	struct wl_list slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+	unsigned int counts[TIMER_WHEEL_LEVELS];
+	struct wl_list expired;
+	/** the next tick to process */
+	uint64_t tick;
+	/** the deadline timerfd currently armed with */
+	uint64_t armed;
+	bool dispatching;
+	int fd;
+};
+
+/**
+ * @brief a free list allocator for fixed size nodes
+ *
+ * Nodes are carved out of chunks allocated from the system and go back to the
+ * free list when freed, the chunks are only released along with the queue. So
+ * once the queue reaches its steady state, adding sources, idle tasks and
+ * timers does not allocate anymore.
+ */
+#define SLAB_CHUNK_NODES 32
+
+struct tw_event_slab_chunk {
+	struct tw_event_slab_chunk *next;
+	max_align_t nodes[];
+};
 
+struct tw_event_slab {
+	size_t size;
+	void *free_nodes;
+	struct tw_event_slab_chunk *chunks;
+	struct tw_event_alloc_stats stats;
 };
+
+struct tw_event_slabs {
+	struct tw_event_slab sources;
+	struct tw_event_slab idle_tasks;
+	struct tw_event_slab timers;
+};
+
+static inline void
+slab_init(struct tw_event_slab *slab, size_t size)
+{
+	size_t align = sizeof(max_align_t);
+
+	slab->size = (MAX(size, sizeof(void *)) + align - 1) / align * align;
+	slab->free_nodes = NULL;
+	slab->chunks = NULL;
+	slab->stats = (struct tw_event_alloc_stats){0};
+}
+
+static void *
+slab_alloc(struct tw_event_slab *slab)
+{
+	void *node;
+
+	if (!slab->free_nodes) {
+		struct tw_event_slab_chunk *chunk =
+			malloc(sizeof(*chunk) + slab->size * SLAB_CHUNK_NODES);
+		if (!chunk)
+			return NULL;
+		chunk->next = slab->chunks;
+		slab->chunks = chunk;
+		for (int i = SLAB_CHUNK_NODES-1; i >= 0; i--) {
+			node = (char *)chunk->nodes + i * slab->size;
+			*(void **)node = slab->free_nodes;
+			slab->free_nodes = node;
+		}
+		slab->stats.sys_allocs++;
+	}
+	node = slab->free_nodes;
+	slab->free_nodes = *(void **)node;
+	slab->stats.allocs++;
+	slab->stats.in_use++;
+	return node;
+}
+
+static inline void
+slab_free(struct tw_event_slab *slab, void *node)
+{
+	*(void **)node = slab->free_nodes;
+	slab->free_nodes = node;
+	slab->stats.frees++;
+	slab->stats.in_use--;
+}
+
+static void
+slab_release(struct tw_event_slab *slab)
+{
+	struct tw_event_slab_chunk *chunk, *next;
+
+	for (chunk = slab->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	slab->chunks = NULL;
+	slab->free_nodes = NULL;
+}
+
+static struct tw_event_slabs *
+event_slabs_create(void)
+{
+	struct tw_event_slabs *slabs = malloc(sizeof(*slabs));
+
+	if (!slabs)
+		return NULL;
+	slab_init(&slabs->sources, sizeof(struct tw_event_source));
+	slab_init(&slabs->idle_tasks, sizeof(struct tw_event_idle));
+	slab_init(&slabs->timers, sizeof(struct tw_event_timer));
+	return slabs;
+}
+
+static void
+event_slabs_destroy(struct tw_event_slabs *slabs)
+{
+	if (!slabs)
+		return;
+	slab_release(&slabs->sources);
+	slab_release(&slabs->idle_tasks);
+	slab_release(&slabs->timers);
+	free(slabs);
+}
+
+static inline size_t
+idle_map_hash(const struct tw_event_idle_map *map, const void *key)
+{
+	//fibonacci hashing, the lower bits of pointers are mostly zero
+	return ((uintptr_t)key * 11400714819323198485llu) >>
+		(64 - __builtin_ctzll(map->cap));
+}
+
+static struct tw_event_idle **
+idle_map_find(struct tw_event_idle_map *map, const void *key)
+{
+	size_t mask = map->cap - 1;
+
+	if (!map->cap)
+		return NULL;
+	for (size_t i = idle_map_hash(map, key); map->slots[i];
+	     i = (i + 1) & mask)
+		if (map->slots[i]->key == key)
+			return &map->slots[i];
+	return NULL;
+}
+
+static bool
+idle_map_insert(struct tw_event_idle_map *map, struct tw_event_idle *idle)
+{
+	size_t mask;
+
+	//keep load factor under 1/2
+	if ((map->len + 1) * 2 > map->cap) {
+		struct tw_event_idle_map grown = {
+			.cap = map->cap ? map->cap * 2 : 16,
+		};
+		grown.slots = calloc(grown.cap, sizeof(*grown.slots));
+		if (!grown.slots)
+			return false;
+		for (size_t i = 0; i < map->cap; i++)
+			if (map->slots[i])
+				idle_map_insert(&grown, map->slots[i]);
+		free(map->slots);
+		*map = grown;
+	}
+	mask = map->cap - 1;
+	for (size_t i = idle_map_hash(map, idle->key); ; i = (i + 1) & mask) {
+		if (!map->slots[i]) {
+			map->slots[i] = idle;
+			map->len++;
+			return true;
+		}
+	}
+}
+
+static void
+idle_map_remove(struct tw_event_idle_map *map, struct tw_event_idle **slot)
+{
+	size_t mask = map->cap - 1;
+	size_t hole = slot - map->slots;
+
+	//backward shift deletion, so we do not need tombstones
+	map->slots[hole] = NULL;
+	map->len--;
+	for (size_t i = (hole + 1) & mask; map->slots[i]; i = (i + 1) & mask) {
+		size_t home = idle_map_hash(map, map->slots[i]->key);
+		//move the entry into the hole if hole is between its home
+		//slot and itself.
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			map->slots[hole] = map->slots[i];
+			map->slots[i] = NULL;
+			hole = i;
+		}
+	}
+}
+
+/*******************************************************************************
+ * instrumentation
+ *
+ * with _TW_EVENT_STATS undefined all of these are empty and the time is never
+ * taken.
+ ******************************************************************************/
+
+static inline uint64_t
+stats_now(void)
+{
+#if defined(_TW_EVENT_STATS)
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+static inline void
+stats_hist_add(struct tw_event_hist *hist, uint64_t start)
+{
+#if defined(_TW_EVENT_STATS)
+	uint64_t ns = stats_now() - start;
+	uint64_t us = ns / 1000;
+	//bucket i takes [2^(i-1), 2^i) us
+	int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+	hist->count++;
+	hist->total_ns += ns;
+	hist->max_ns = MAX(hist->max_ns, ns);
+	hist->buckets[MIN(bucket, TW_EVENT_HIST_BUCKETS-1)]++;
+#endif
+}
+
+static inline void
+stats_record_wait(struct tw_event_queue *queue, uint64_t start)
+{
+#if defined(_TW_EVENT_STATS)
+	if (!queue->stats)
+		return;
+	stats_hist_add(&queue->stats->stats.wait_time, start);
+	queue->stats->stats.wakeups++;
+#endif
+}
+
+static inline void
+stats_record_idle(struct tw_event_queue *queue, uint64_t start)
+{
+#if defined(_TW_EVENT_STATS)
+	if (queue->stats)
+		stats_hist_add(&queue->stats->stats.idle_time, start);
+#endif
+}
+
+static inline void
+stats_record_read(struct tw_event_source *s, uint64_t start)
+{
+#if defined(_TW_EVENT_STATS)
+	stats_hist_add(&s->read_time, start);
+#endif
+}
+
+static inline void
+stats_record_dispatch(struct tw_event_source *s, uint64_t start)
+{
+#if defined(_TW_EVENT_STATS)
+	stats_hist_add(&s->dispatch_time, start);
+#endif
+}
+
 //file local storage
 static struct udev *UDEV = NULL;
 
+static void timer_wheel_destroy(struct tw_event_queue *queue);
+static bool event_mailbox_create(struct tw_event_queue *queue);
+static void event_mailbox_destroy(struct tw_event_queue *queue);
+static void work_pool_destroy(struct tw_event_queue *queue);
+static bool uring_create(struct tw_event_queue *queue);
+static void uring_destroy(struct tw_event_queue *queue);
+static bool uring_watch(struct tw_event_queue *queue,
+                        struct tw_event_source *s);
+static void uring_unwatch(struct tw_event_queue *queue,
+                          struct tw_event_source *s);
+static void uring_poll(struct tw_event_queue *queue, int timeout);
+static void uring_flush(struct tw_event_queue *queue);
+static int uring_get_fd(struct tw_event_queue *queue);
+static void event_stats_destroy(struct tw_event_queue *queue);
+static void inotify_destroy(struct tw_event_queue *queue);
+static void udev_destroy(struct tw_event_queue *queue);
+static void signals_destroy(struct tw_event_queue *queue);
+
 
 static void close_fd(struct tw_event_source *s)
 {
 	close(s->fd);
 }
 
-static struct tw_event_source*
-alloc_event_source(struct tw_event *e, uint32_t mask, int fd)
+static struct tw_event_source*
+alloc_event_source(struct tw_event_queue *queue, struct tw_event *e,
+                   uint32_t mask, int fd)
+{
+	struct tw_event_source *event_source = (queue->slabs) ?
+		slab_alloc(&queue->slabs->sources) : NULL;
+
+	if (!event_source)
+		return NULL;
+	wl_list_init(&event_source->link);
+	event_source->event = *e;
+	event_source->poll_event.data.ptr = event_source;
+	event_source->poll_event.events = mask;
+	event_source->fd = fd;
+	event_source->read_size = 0;
+	event_source->on_read = NULL;
+	event_source->close = close_fd;
+	event_source->op = NULL;
+	wl_list_init(&event_source->ready_link);
+	event_source->priority = TW_EVENT_PRIORITY_DEFAULT;
+	event_source->kind = TW_TRACE_SOURCE_GENERAL;
+	event_source->pending_read = false;
+	event_source->dispatching = false;
+	event_source->dead = false;
+#if defined(_TW_EVENT_STATS)
+	event_source->read_time = (struct tw_event_hist){0};
+	event_source->dispatch_time = (struct tw_event_hist){0};
+#endif
+	return event_source;
+}
+
+/**
+ * @brief grow the fd table so `fd` fits in, the table only grows in powers of
+ * two so the amortized cost stays constant.
+ */
+static bool
+event_sources_reserve(struct tw_event_queue *queue, int fd)
+{
+	struct tw_event_source **sources;
+	int len = queue->sources_len ? queue->sources_len : 64;
+
+	if (fd < queue->sources_len)
+		return true;
+	while (len <= fd)
+		len *= 2;
+	sources = realloc(queue->sources, len * sizeof(*sources));
+	if (!sources)
+		return false;
+	memset(sources + queue->sources_len, 0,
+	       (len - queue->sources_len) * sizeof(*sources));
+	queue->sources = sources;
+	queue->sources_len = len;
+	return true;
+}
+
+static inline bool
+insert_event_source(struct tw_event_queue *queue, struct tw_event_source *s)
+{
+	if (s->fd >= 0 && !event_sources_reserve(queue, s->fd))
+		return false;
+	wl_list_insert(&queue->head, &s->link);
+	if (s->fd >= 0)
+		queue->sources[s->fd] = s;
+	return true;
+}
+
+/**
+ * @brief start polling on an inserted source, through the ring if we have one
+ */
+static inline bool
+event_source_watch(struct tw_event_queue *queue, struct tw_event_source *s)
+{
+	if (queue->uring)
+		return uring_watch(queue, s);
+	return !epoll_ctl(queue->pollfd, EPOLL_CTL_ADD, s->fd, &s->poll_event);
+}
+
+static inline void
+event_source_unwatch(struct tw_event_queue *queue, struct tw_event_source *s)
+{
+	if (queue->uring)
+		uring_unwatch(queue, s);
+	else
+		epoll_ctl(queue->pollfd, EPOLL_CTL_DEL, s->fd, NULL);
+}
+
+static inline void
+event_source_drain(struct tw_event_source *s)
+{
+	char data[TW_EVENT_READ_MAX] __attribute__((aligned(8)));
+	uint64_t start = stats_now();
+	ssize_t len = read(s->fd, data, MIN(s->read_size, sizeof(data)));
+
+	if (s->on_read)
+		s->on_read(s, data, len);
+	stats_record_read(s, start);
+}
+
+static inline void
+destroy_event_source(struct tw_event_queue *queue, struct tw_event_source *s)
+{
+	if (!s->dead) {
+		//this is a no-op for the sources never watched
+		event_source_unwatch(queue, s);
+		wl_list_remove(&s->ready_link);
+		wl_list_init(&s->ready_link);
+		if (s->fd >= 0 && s->fd < queue->sources_len &&
+		    queue->sources[s->fd] == s)
+			queue->sources[s->fd] = NULL;
+		wl_list_remove(&s->link);
+		wl_list_init(&s->link);
+		s->dead = true;
+	}
+	//dispatch_event_source frees it
+	if (s->dispatching)
+		return;
+	if (s->close)
+		s->close(s);
+	slab_free(&queue->slabs->sources, s);
+}
+
+/**
+ * @brief queue a source for the next dispatch, `read` if it still needs to be
+ * drained.
+ */
+static inline void
+event_source_set_ready(struct tw_event_queue *queue,
+                       struct tw_event_source *s, bool read)
+{
+	//removed in its callback, only waiting to be freed
+	if (s->dead)
+		return;
+	s->pending_read = s->pending_read || read;
+	if (wl_list_empty(&s->ready_link))
+		wl_list_insert(queue->ready[s->priority].prev, &s->ready_link);
+}
+
+/**
+ * @brief run the callback of a ready source, the source is destroyed if it
+ * returns TW_EVENT_DEL
+ *
+ * TW_EVENT_DEL is returned as well when the callback removed the source, `s`
+ * is gone then.
+ */
+static inline int
+dispatch_event_source(struct tw_event_queue *queue, struct tw_event_source *s)
+{
+	struct tw_event_trace *trace = queue->trace;
+	uint64_t start, trace_start = 0;
+	int output;
+
+	if (s->pending_read) {
+		s->pending_read = false;
+		event_source_drain(s);
+	}
+	if (trace)
+		trace_start = _tw_trace_now();
+	start = stats_now();
+	s->dispatching = true;
+	output = s->event.cb(&s->event, s->fd);
+	s->dispatching = false;
+	stats_record_dispatch(s, start);
+	//the callback may stop the trace, or start one which began after us
+	if (trace && queue->trace == trace)
+		_tw_trace_record_source(trace, s->kind, s->fd, output,
+		                        trace_start);
+	if (output == TW_EVENT_DEL || s->dead) {
+		destroy_event_source(queue, s);
+		return TW_EVENT_DEL;
+	}
+	return output;
+}
+
+/**
+ * @brief dispatch the ready sources by priority
+ *
+ * every source runs at most once here, the ones returning TW_EVENT_AGAIN are
+ * carried into the next iteration. The sources destroyed on the way simply
+ * drop out of the lists, the ones removed by their own callback come back as
+ * TW_EVENT_DEL and are neither carried nor re-armed.
+ */
+static int
+dispatch_ready_sources(struct tw_event_queue *queue)
+{
+	struct tw_event_source *s;
+	struct wl_list batch;
+	int output, count = 0;
+
+	for (int p = 0; p < TW_EVENT_PRIORITIES; p++) {
+		wl_list_init(&batch);
+		wl_list_insert_list(&batch, &queue->ready[p]);
+		wl_list_init(&queue->ready[p]);
+
+		while (!wl_list_empty(&batch)) {
+			s = wl_container_of(batch.next, s, ready_link);
+			wl_list_remove(&s->ready_link);
+			wl_list_init(&s->ready_link);
+
+			output = dispatch_event_source(queue, s);
+			count++;
+			if (output == TW_EVENT_AGAIN)
+				event_source_set_ready(queue, s, false);
+			else if (output != TW_EVENT_DEL && queue->uring)
+				uring_watch(queue, s);
+		}
+	}
+	return count;
+}
+
+static inline bool
+event_queue_has_ready(const struct tw_event_queue *queue)
+{
+	for (int p = 0; p < TW_EVENT_PRIORITIES; p++)
+		if (!wl_list_empty(&queue->ready[p]))
+			return true;
+	return false;
+}
+
+static inline struct tw_event_source*
+event_source_from_fd(struct tw_event_queue *queue, int fd)
+{
+	if (fd < 0 || fd >= queue->sources_len)
+		return NULL;
+	return queue->sources[fd];
+}
+
+WL_EXPORT void
+tw_event_queue_close(struct tw_event_queue *queue)
+{
+	struct tw_event_source *event_source, *next;
+
+	//workers may still post to the mailbox until they are joined
+	work_pool_destroy(queue);
+	tw_event_queue_stop_trace(queue);
+	wl_list_for_each_safe(event_source, next, &queue->head, link)
+		destroy_event_source(queue, event_source);
+	for (int p = 0; p < TW_EVENT_PRIORITIES; p++)
+		wl_list_init(&queue->ready[p]);
+	event_stats_destroy(queue);
+	inotify_destroy(queue);
+	udev_destroy(queue);
+	signals_destroy(queue);
+	timer_wheel_destroy(queue);
+	event_mailbox_destroy(queue);
+	//after the sources, so we can wait for their requests to cancel
+	uring_destroy(queue);
+	//the pending idle tasks go away with the slabs
+	wl_list_init(&queue->idle_tasks);
+	if (queue->idle_keys)
+		free(queue->idle_keys->slots);
+	free(queue->idle_keys);
+	queue->idle_keys = NULL;
+	event_slabs_destroy(queue->slabs);
+	queue->slabs = NULL;
+	free(queue->sources);
+	queue->sources = NULL;
+	queue->sources_len = 0;
+	//the queue may be closed by both run and tw_globals_release
+	if (queue->pollfd >= 0)
+		close(queue->pollfd);
+	queue->pollfd = -1;
+}
+
+static inline uint64_t
+event_now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void
+event_queue_count_wakeup(struct tw_event_queue *queue)
+{
+	struct tw_event_wakeups *wakeups = &queue->wakeups;
+	uint64_t now = event_now_us() / 1000;
+
+	if (now - wakeups->window_start >= 60000) {
+		//the window before did not see any wakeup if it is that old
+		wakeups->last_minute = now - wakeups->window_start < 120000 ?
+			wakeups->window : 0;
+		wakeups->window_start = now;
+		wakeups->window = 0;
+	}
+	wakeups->window++;
+	wakeups->total++;
+}
+
+/**
+ * @brief run the idle tasks until the queue is empty or we are over the
+ * budget, at least one task runs every iteration.
+ */
+static void
+run_idle_tasks(struct tw_event_queue *queue)
+{
+	struct tw_event_idle *idle;
+	uint64_t begin = queue->idle_budget_us ? event_now_us() : 0;
+	uint64_t start;
+
+	while (!wl_list_empty(&queue->idle_tasks)) {
+		idle = container_of(queue->idle_tasks.prev,
+		                    struct tw_event_idle, link);
+		wl_list_remove(&idle->link);
+		if (idle->key)
+			idle_map_remove(queue->idle_keys,
+			                idle_map_find(queue->idle_keys,
+			                              idle->key));
+		start = stats_now();
+		idle->event.cb(&idle->event, 0);
+		stats_record_idle(queue, start);
+		slab_free(&queue->slabs->idle_tasks, idle);
+
+		if (queue->idle_budget_us &&
+		    event_now_us() - begin >= queue->idle_budget_us)
+			break;
+	}
+}
+
+static void
+epoll_poll(struct tw_event_queue *queue, int timeout)
+{
+	struct epoll_event events[32];
+	struct tw_event_source *event_source;
+	uint64_t start = stats_now();
+	int count = epoll_wait(queue->pollfd, events, 32, timeout);
+
+	stats_record_wait(queue, start);
+	for (int i = 0; i < count; i++) {
+		event_source = events[i].data.ptr;
+		event_source_set_ready(queue, event_source,
+		                       event_source->read_size);
+	}
+}
+
+static inline bool
+event_queue_is_busy(const struct tw_event_queue *queue)
+{
+	return !wl_list_empty(&queue->idle_tasks) ||
+		event_queue_has_ready(queue);
+}
+
+WL_EXPORT int
+tw_event_queue_get_fd(struct tw_event_queue *queue)
+{
+	return queue->uring ? uring_get_fd(queue) : queue->pollfd;
+}
+
+WL_EXPORT int
+tw_event_queue_dispatch(struct tw_event_queue *queue, int timeout_ms)
+{
+	if (queue->pollfd < 0)
+		return -1;
+	run_idle_tasks(queue);
+	/* wl_display_dispatch_pending(queue->wl_display); */
+
+	if (queue->wl_display)
+		wl_display_flush(queue->wl_display);
+
+	//do not block if we still have work left from last time
+	if (event_queue_is_busy(queue))
+		timeout_ms = 0;
+	if (queue->uring)
+		uring_poll(queue, timeout_ms);
+	else
+		epoll_poll(queue, timeout_ms);
+	if (timeout_ms)
+		event_queue_count_wakeup(queue);
+	return dispatch_ready_sources(queue);
+}
+
+WL_EXPORT uint32_t
+tw_event_queue_get_wakeups_per_minute(const struct tw_event_queue *queue)
+{
+	const struct tw_event_wakeups *wakeups = &queue->wakeups;
+	uint64_t elapsed = event_now_us() / 1000 - wakeups->window_start;
+
+	if (elapsed >= 120000)
+		return 0;
+	else if (elapsed >= 60000)
+		return wakeups->window;
+	return wakeups->last_minute;
+}
+
+WL_EXPORT void
+tw_event_queue_run(struct tw_event_queue *queue)
+{
+	//poll->produce-event-or-timeout
+	while (!queue->quit)
+		tw_event_queue_dispatch(queue, -1);
+	tw_event_queue_close(queue);
+	//udev object is global here. So we destroy it by hand
+	if (UDEV) {
+		udev_unref(UDEV);
+		UDEV = NULL;
+	}
+	return;
+}
+
+WL_EXPORT bool
+tw_event_queue_init(struct tw_event_queue *queue)
+{
+	int fd = epoll_create1(EPOLL_CLOEXEC);
+	if (fd == -1)
+		return false;
+	queue->slabs = event_slabs_create();
+	queue->idle_keys = calloc(1, sizeof(*queue->idle_keys));
+	if (!queue->slabs || !queue->idle_keys) {
+		event_slabs_destroy(queue->slabs);
+		free(queue->idle_keys);
+		close(fd);
+		return false;
+	}
+	wl_list_init(&queue->head);
+	wl_list_init(&queue->idle_tasks);
+	for (int p = 0; p < TW_EVENT_PRIORITIES; p++)
+		wl_list_init(&queue->ready[p]);
+	queue->idle_budget_us = TW_EVENT_IDLE_BUDGET_US;
+	queue->wakeups = (struct tw_event_wakeups){
+		.window_start = event_now_us() / 1000,
+	};
+
+	queue->sources = NULL;
+	queue->sources_len = 0;
+	queue->timers = NULL;
+	queue->mailbox = NULL;
+	queue->workers = NULL;
+	queue->uring = NULL;
+	queue->stats = NULL;
+	queue->inotify = NULL;
+	queue->udev = NULL;
+	queue->signals = NULL;
+	queue->trace = NULL;
+#if defined(_TW_EVENT_STATS)
+	queue->stats = calloc(1, sizeof(*queue->stats));
+	if (queue->stats)
+		queue->stats->start = stats_now();
+#endif
+	queue->pollfd = fd;
+	queue->quit = false;
+	//we fall back to epoll if the kernel does not give us a ring
+	uring_create(queue);
+	if (!event_mailbox_create(queue)) {
+		tw_event_queue_close(queue);
+		return false;
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * inotify
+ ******************************************************************************/
+
+#if !defined(IN_MASK_CREATE)
+#define IN_MASK_CREATE 0x10000000
+#endif
+
+/* enough for at least one event with the longest name */
+#define TW_INOTIFY_EVENT_MAX (sizeof(struct inotify_event) + NAME_MAX + 1)
+
+static inline size_t
+watch_map_hash(const struct tw_event_inotify *inotify, int wd)
+{
+	return ((uint32_t)wd * 2654435769u) >>
+		(32 - __builtin_ctzll(inotify->cap));
+}
+
+static struct tw_event_watch **
+watch_map_find(struct tw_event_inotify *inotify, int wd)
+{
+	size_t mask = inotify->cap - 1;
+
+	if (!inotify->cap)
+		return NULL;
+	for (size_t i = watch_map_hash(inotify, wd); inotify->slots[i];
+	     i = (i + 1) & mask)
+		if (inotify->slots[i]->wd == wd)
+			return &inotify->slots[i];
+	return NULL;
+}
+
+static bool
+watch_map_insert(struct tw_event_inotify *inotify,
+                 struct tw_event_watch *watch)
+{
+	size_t mask;
+
+	if ((inotify->len + 1) * 2 > inotify->cap) {
+		struct tw_event_watch **old = inotify->slots;
+		size_t old_cap = inotify->cap;
+		size_t cap = old_cap ? old_cap * 2 : 64;
+		struct tw_event_watch **slots = calloc(cap, sizeof(*slots));
+
+		if (!slots)
+			return false;
+		inotify->slots = slots;
+		inotify->cap = cap;
+		inotify->len = 0;
+		for (size_t i = 0; i < old_cap; i++)
+			if (old[i])
+				watch_map_insert(inotify, old[i]);
+		free(old);
+	}
+	mask = inotify->cap - 1;
+	for (size_t i = watch_map_hash(inotify, watch->wd); ;
+	     i = (i + 1) & mask) {
+		if (!inotify->slots[i]) {
+			inotify->slots[i] = watch;
+			inotify->len++;
+			return true;
+		}
+	}
+}
+
+static void
+watch_map_remove(struct tw_event_inotify *inotify,
+                 struct tw_event_watch **slot)
+{
+	size_t mask = inotify->cap - 1;
+	size_t hole = slot - inotify->slots;
+
+	//backward shift deletion, same as the idle map
+	inotify->slots[hole] = NULL;
+	inotify->len--;
+	for (size_t i = (hole + 1) & mask; inotify->slots[i];
+	     i = (i + 1) & mask) {
+		size_t home = watch_map_hash(inotify, inotify->slots[i]->wd);
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			inotify->slots[hole] = inotify->slots[i];
+			inotify->slots[i] = NULL;
+			hole = i;
+		}
+	}
+}
+
+static void
+watch_add_change(struct tw_event_inotify *inotify,
+                 struct tw_event_watch *watch,
+                 const struct inotify_event *event)
+{
+	struct tw_event_file_change *change;
+	size_t len = event->len ? strlen(event->name) + 1 : 0;
+	char *name;
+
+	change = wl_array_add(&watch->changes, sizeof(*change));
+	if (!change)
+		return;
+	change->mask = event->mask;
+	change->cookie = event->cookie;
+	//offset + 1 for now, 0 stays for no name
+	change->name = NULL;
+	if (len && (name = wl_array_add(&watch->names, len))) {
+		memcpy(name, event->name, len);
+		change->name = (const char *)(uintptr_t)
+			(name - (char *)watch->names.data + 1);
+	}
+	if (wl_list_empty(&watch->pending_link))
+		wl_list_insert(inotify->pending.prev, &watch->pending_link);
+}
+
+static void
+inotify_parse(struct tw_event_inotify *inotify, const char *data, ssize_t len)
+{
+	const struct inotify_event *event;
+	struct tw_event_watch **slot;
+
+	inotify->more = len > (ssize_t)(TW_EVENT_READ_MAX - TW_INOTIFY_EVENT_MAX);
+	for (ssize_t off = 0; off + (ssize_t)sizeof(*event) <= len;
+	     off += sizeof(*event) + event->len) {
+		event = (const struct inotify_event *)(data + off);
+		//the queue overflowed, everyone has to rescan
+		if (event->mask & IN_Q_OVERFLOW) {
+			for (size_t i = 0; i < inotify->cap; i++)
+				if (inotify->slots[i])
+					watch_add_change(inotify,
+					                 inotify->slots[i],
+					                 event);
+			continue;
+		}
+		slot = watch_map_find(inotify, event->wd);
+		//the events of the removed watches may still arrive
+		if (slot && !(*slot)->removed)
+			watch_add_change(inotify, *slot, event);
+	}
+}
+
+static void
+read_inotify(struct tw_event_source *s, const void *data, ssize_t len)
+{
+	struct tw_event_queue *queue = s->event.data;
+
+	inotify_parse(queue->inotify, data, len);
+}
+
+static void
+watch_destroy(struct tw_event_inotify *inotify, struct tw_event_watch *watch)
+{
+	struct tw_event_watch **slot = watch_map_find(inotify, watch->wd);
+
+	if (slot && *slot == watch)
+		watch_map_remove(inotify, slot);
+	wl_list_remove(&watch->pending_link);
+	wl_array_release(&watch->changes);
+	wl_array_release(&watch->names);
+	free(watch);
+}
+
+static int
+dispatch_inotify(struct tw_event *e, int fd)
+{
+	struct tw_event_queue *queue = e->data;
+	struct tw_event_inotify *inotify = queue->inotify;
+	struct tw_event_file_change *change;
+	struct tw_event_watch *watch;
+	char data[TW_EVENT_READ_MAX] __attribute__((aligned(8)));
+	bool ignored;
+	ssize_t len;
+	int output;
+
+	//the first read is done for us, drain the rest
+	while (inotify->more) {
+		len = read(fd, data, sizeof(data));
+		inotify->more = false;
+		if (len > 0)
+			inotify_parse(inotify, data, len);
+	}
+
+	while (!wl_list_empty(&inotify->pending)) {
+		watch = wl_container_of(inotify->pending.next, watch,
+		                        pending_link);
+		wl_list_remove(&watch->pending_link);
+		wl_list_init(&watch->pending_link);
+
+		ignored = false;
+		wl_array_for_each(change, &watch->changes) {
+			if (change->name)
+				change->name = (char *)watch->names.data +
+					((uintptr_t)change->name - 1);
+			//kernel dropped the watch, the file is gone
+			ignored = ignored || (change->mask & IN_IGNORED);
+		}
+		inotify->current = watch;
+		output = watch->event.cb(&watch->event, watch->wd);
+		inotify->current = NULL;
+
+		watch->changes.size = 0;
+		watch->names.size = 0;
+		//still watched by the kernel
+		if (output == TW_EVENT_DEL && !ignored && !watch->removed)
+			inotify_rm_watch(fd, watch->wd);
+		if (output == TW_EVENT_DEL || ignored || watch->removed)
+			watch_destroy(inotify, watch);
+	}
+	return TW_EVENT_NOOP;
+}
+
+static struct tw_event_inotify *
+inotify_create(struct tw_event_queue *queue)
+{
+	struct tw_event_source *s;
+	struct tw_event dispatch_watches = {
+		.data = queue,
+		.cb = dispatch_inotify,
+	};
+	struct tw_event_inotify *inotify = calloc(1, sizeof(*inotify));
+
+	if (!inotify)
+		return NULL;
+	wl_list_init(&inotify->pending);
+	inotify->fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (inotify->fd < 0) {
+		free(inotify);
+		return NULL;
+	}
+	s = alloc_event_source(queue, &dispatch_watches, EPOLLIN | EPOLLET,
+	                       inotify->fd);
+	if (!s) {
+		close(inotify->fd);
+		free(inotify);
+		return NULL;
+	}
+	s->kind = TW_TRACE_SOURCE_FILE;
+	s->read_size = TW_EVENT_READ_MAX;
+	s->on_read = read_inotify;
+	//read_inotify needs it
+	queue->inotify = inotify;
+	if (!insert_event_source(queue, s) ||
+	    !event_source_watch(queue, s)) {
+		//this closes the fd
+		destroy_event_source(queue, s);
+		queue->inotify = NULL;
+		free(inotify);
+		return NULL;
+	}
+	return inotify;
+}
+
+static void
+inotify_destroy(struct tw_event_queue *queue)
+{
+	struct tw_event_inotify *inotify = queue->inotify;
+
+	if (!inotify)
+		return;
+	//the fd is closed along with its source
+	for (size_t i = 0; i < inotify->cap; i++)
+		if (inotify->slots[i]) {
+			struct tw_event_watch *watch = inotify->slots[i];
+			wl_array_release(&watch->changes);
+			wl_array_release(&watch->names);
+			free(watch);
+		}
+	free(inotify->slots);
+	free(inotify);
+	queue->inotify = NULL;
+}
+
+WL_EXPORT int
+tw_event_queue_add_file(struct tw_event_queue *queue, const char *path,
+			struct tw_event *e, uint32_t mask)
+{
+	struct tw_event_inotify *inotify = queue->inotify;
+	struct tw_event_watch *watch, **slot;
+	int wd;
+
+	if (!mask)
+		mask = IN_MODIFY | IN_DELETE;
+	if (!is_file_exist(path))
+		return -1;
+	if (!inotify && !(inotify = inotify_create(queue)))
+		return -1;
+	//a file watched already keeps its mask and its event, it fails with
+	//EEXIST instead of replacing them
+	wd = inotify_add_watch(inotify->fd, path, mask | IN_MASK_CREATE);
+	if (wd < 0)
+		return -1;
+	//kernels before 4.18 ignore the flag, the mask is replaced but the
+	//event stays
+	slot = watch_map_find(inotify, wd);
+	if (slot && !(*slot)->removed) {
+		errno = EEXIST;
+		return -1;
+	} else if (slot) {
+		watch_map_remove(inotify, slot);
+	}
+
+	watch = calloc(1, sizeof(*watch));
+	if (!watch) {
+		inotify_rm_watch(inotify->fd, wd);
+		return -1;
+	}
+	watch->wd = wd;
+	watch->event = *e;
+	wl_array_init(&watch->changes);
+	wl_array_init(&watch->names);
+	wl_list_init(&watch->pending_link);
+	if (!watch_map_insert(inotify, watch)) {
+		inotify_rm_watch(inotify->fd, wd);
+		free(watch);
+		return -1;
+	}
+	return wd;
+}
+
+WL_EXPORT bool
+tw_event_queue_remove_file(struct tw_event_queue *queue, int wd)
+{
+	struct tw_event_inotify *inotify = queue->inotify;
+	struct tw_event_watch **slot =
+		inotify ? watch_map_find(inotify, wd) : NULL;
+	struct tw_event_watch *watch = slot ? *slot : NULL;
+
+	if (!watch || watch->removed)
+		return false;
+	inotify_rm_watch(inotify->fd, wd);
+	//freed after its callback
+	if (watch == inotify->current)
+		watch->removed = true;
+	else
+		watch_destroy(inotify, watch);
+	return true;
+}
+
+WL_EXPORT const struct tw_event_file_change *
+tw_event_get_file_changes(struct tw_event_queue *queue, int wd, size_t *n)
+{
+	struct tw_event_inotify *inotify = queue->inotify;
+	struct tw_event_watch *watch = inotify ? inotify->current : NULL;
+
+	*n = 0;
+	if (!watch || watch->wd != wd)
+		return NULL;
+	*n = watch->changes.size / sizeof(struct tw_event_file_change);
+	return watch->changes.data;
+}
+
+/*******************************************************************************
+ * udev
+ ******************************************************************************/
+
+static inline bool
+udev_str_equal(const char *a, const char *b)
+{
+	return (!a && !b) || (a && b && !strcmp(a, b));
+}
+
+/**
+ * @brief a devname starting with '/' matches the device node, others match
+ * the start of the sysname, so "BAT" takes BAT0 and BAT1.
+ */
+static bool
+udev_watch_match(const struct tw_udev_watch *watch, struct udev_device *dev)
+{
+	const char *name;
+
+	if (!watch->devname_len)
+		return true;
+	if (watch->devname[0] == '/') {
+		name = udev_device_get_devnode(dev);
+		return name && !strcmp(name, watch->devname);
+	}
+	name = udev_device_get_sysname(dev);
+	return name && !strncmp(name, watch->devname, watch->devname_len);
+}
+
+static void
+close_udev_monitor(struct tw_event_source *src)
+{
+	struct tw_udev_monitor *monitor = src->event.data;
+	struct tw_udev_watch *watch, *tmp;
+
+	wl_list_for_each_safe(watch, tmp, &monitor->watches, link)
+		free(watch);
+	wl_list_remove(&monitor->link);
+	udev_monitor_unref(monitor->mon);
+	free(monitor->subsystem);
+	free(monitor->tag);
+	free(monitor);
+}
+
+static void
+udev_monitor_sweep(struct tw_udev_monitor *monitor)
+{
+	struct tw_udev_watch *watch, *tmp;
+
+	wl_list_for_each_safe(watch, tmp, &monitor->watches, link)
+		if (watch->removed) {
+			wl_list_remove(&watch->link);
+			free(watch);
+		}
+}
+
+static int
+dispatch_udev_monitor(struct tw_event *e, int fd)
+{
+	struct tw_udev_monitor *monitor = e->data;
+	struct tw_event_udev *udev = monitor->queue->udev;
+	struct tw_udev_watch *watch;
+	struct udev_device *dev;
+
+	//watches removed from now on are only marked
+	monitor->dispatching = true;
+	while ((dev = udev_monitor_receive_device(monitor->mon))) {
+		wl_list_for_each(watch, &monitor->watches, link) {
+			if (watch->removed || !udev_watch_match(watch, dev))
+				continue;
+			udev->current = watch;
+			udev->current_dev = dev;
+			if (watch->event.cb(&watch->event, watch->handle) ==
+			    TW_EVENT_DEL)
+				watch->removed = true;
+		}
+		udev->current = NULL;
+		udev->current_dev = NULL;
+		udev_device_unref(dev);
+	}
+	monitor->dispatching = false;
+	udev_monitor_sweep(monitor);
+	return wl_list_empty(&monitor->watches) ?
+		TW_EVENT_DEL : TW_EVENT_NOOP;
+}
+
+static struct tw_udev_monitor *
+udev_monitor_get(struct tw_event_queue *queue, const char *subsystem,
+                 const char *tag)
+{
+	struct tw_event_udev *udev = queue->udev;
+	struct tw_udev_monitor *monitor;
+	struct tw_event_source *s;
+	struct tw_event dispatch_devices = {
+		.cb = dispatch_udev_monitor,
+	};
+
+	wl_list_for_each(monitor, &udev->monitors, link)
+		if (udev_str_equal(monitor->subsystem, subsystem) &&
+		    udev_str_equal(monitor->tag, tag))
+			return monitor;
+
+	monitor = calloc(1, sizeof(*monitor));
+	if (!monitor)
+		return NULL;
+	monitor->queue = queue;
+	wl_list_init(&monitor->watches);
+	monitor->subsystem = strdup(subsystem);
+	monitor->tag = tag ? strdup(tag) : NULL;
+	monitor->mon = udev_monitor_new_from_netlink(UDEV, "udev");
+	if (!monitor->subsystem || (tag && !monitor->tag) || !monitor->mon)
+		goto err;
+	//the filters go into the socket as BPF, we never see the rest
+	udev_monitor_filter_add_match_subsystem_devtype(monitor->mon,
+	                                                subsystem, NULL);
+	if (tag)
+		udev_monitor_filter_add_match_tag(monitor->mon, tag);
+	if (udev_monitor_enable_receiving(monitor->mon) < 0)
+		goto err;
+
+	dispatch_devices.data = monitor;
+	s = alloc_event_source(queue, &dispatch_devices, EPOLLIN | EPOLLET,
+	                       udev_monitor_get_fd(monitor->mon));
+	if (!s)
+		goto err;
+	s->kind = TW_TRACE_SOURCE_DEVICE;
+	s->close = close_udev_monitor;
+	monitor->source = s;
+	wl_list_insert(&udev->monitors, &monitor->link);
+	if (!insert_event_source(queue, s) ||
+	    !event_source_watch(queue, s)) {
+		//this frees the monitor
+		destroy_event_source(queue, s);
+		return NULL;
+	}
+	return monitor;
+err:
+	if (monitor->mon)
+		udev_monitor_unref(monitor->mon);
+	free(monitor->subsystem);
+	free(monitor->tag);
+	free(monitor);
+	return NULL;
+}
+
+static void
+udev_destroy(struct tw_event_queue *queue)
+{
+	//the monitors are gone with their sources
+	free(queue->udev);
+	queue->udev = NULL;
+}
+
+WL_EXPORT struct udev_device *
+tw_event_get_udev_device(struct tw_event_queue *queue, int handle)
+{
+	struct tw_event_udev *udev = queue->udev;
+
+	if (!udev || !udev->current || udev->current->handle != handle)
+		return NULL;
+	//user has the responsibility to unref it
+	return udev_device_ref(udev->current_dev);
+}
+
+WL_EXPORT int
+tw_event_queue_add_tagged_device(struct tw_event_queue *queue,
+                                 const char *subsystem, const char *tag,
+                                 const char *devname, struct tw_event *e)
+{
+	struct tw_udev_monitor *monitor;
+	struct tw_udev_watch *watch;
+	size_t len = devname ? strlen(devname) : 0;
+
+	if (!subsystem)
+		return -1;
+	if (!UDEV)
+		UDEV = udev_new();
+	if (!queue->udev) {
+		queue->udev = calloc(1, sizeof(*queue->udev));
+		if (!queue->udev)
+			return -1;
+		wl_list_init(&queue->udev->monitors);
+	}
+	monitor = udev_monitor_get(queue, subsystem, tag);
+	if (!monitor)
+		return -1;
+
+	watch = calloc(1, sizeof(*watch) + len + 1);
+	if (!watch) {
+		if (wl_list_empty(&monitor->watches))
+			destroy_event_source(queue, monitor->source);
+		return -1;
+	}
+	watch->event = *e;
+	watch->handle = ++queue->udev->next_handle;
+	watch->devname_len = len;
+	if (len)
+		memcpy(watch->devname, devname, len);
+	wl_list_insert(monitor->watches.prev, &watch->link);
+	return watch->handle;
+}
+
+WL_EXPORT int
+tw_event_queue_add_device(struct tw_event_queue *queue, const char *subsystem,
+			  const char *devname, struct tw_event *e)
+{
+	return tw_event_queue_add_tagged_device(queue, subsystem, NULL,
+	                                        devname, e);
+}
+
+WL_EXPORT bool
+tw_event_queue_remove_device(struct tw_event_queue *queue, int handle)
+{
+	struct tw_udev_monitor *monitor;
+	struct tw_udev_watch *watch;
+
+	if (!queue->udev)
+		return false;
+	wl_list_for_each(monitor, &queue->udev->monitors, link)
+		wl_list_for_each(watch, &monitor->watches, link) {
+			if (watch->handle != handle || watch->removed)
+				continue;
+			watch->removed = true;
+			if (monitor->dispatching)
+				return true;
+			udev_monitor_sweep(monitor);
+			if (wl_list_empty(&monitor->watches))
+				destroy_event_source(queue, monitor->source);
+			return true;
+		}
+	return false;
+}
+
+/*******************************************************************************
+ * signals and child processes
+ ******************************************************************************/
+
+#if !defined(SYS_pidfd_open)
+#define SYS_pidfd_open 434
+#endif
+
+static struct tw_event_signals *
+event_signals_get(struct tw_event_queue *queue)
+{
+	if (!queue->signals) {
+		queue->signals = calloc(1, sizeof(*queue->signals));
+		if (!queue->signals)
+			return NULL;
+		queue->signals->fd = -1;
+		sigemptyset(&queue->signals->mask);
+		sigemptyset(&queue->signals->blocked);
+	}
+	return queue->signals;
+}
+
+static void
+signals_parse(struct tw_event_signals *signals, const void *data, ssize_t len)
+{
+	const struct signalfd_siginfo *info = data;
+
+	signals->more = len + sizeof(*info) > TW_EVENT_READ_MAX;
+	for (; len >= (ssize_t)sizeof(*info); len -= sizeof(*info), info++)
+		if (info->ssi_signo >= 1 && info->ssi_signo <= 64)
+			signals->pending |= 1ull << (info->ssi_signo - 1);
+}
+
+static void
+read_signals(struct tw_event_source *s, const void *data, ssize_t len)
+{
+	struct tw_event_queue *queue = s->event.data;
+
+	signals_parse(queue->signals, data, len);
+}
+
+static int
+dispatch_signals(struct tw_event *e, int fd)
+{
+	struct tw_event_queue *queue = e->data;
+	struct tw_event_signals *signals = queue->signals;
+	char data[TW_EVENT_READ_MAX] __attribute__((aligned(8)));
+	struct tw_event *event;
+	ssize_t len;
+	int signo;
+
+	//the first read is done for us, drain the rest
+	while (signals->more) {
+		len = read(fd, data, sizeof(data));
+		signals->more = false;
+		if (len > 0)
+			signals_parse(signals, data, len);
+	}
+	//the same signal arriving twice is coalesced, like a handler would
+	while (signals->pending) {
+		signo = __builtin_ctzll(signals->pending) + 1;
+		signals->pending &= ~(1ull << (signo - 1));
+		event = &signals->events[signo - 1];
+		if (event->cb && event->cb(event, signo) == TW_EVENT_DEL)
+			tw_event_queue_remove_signal(queue, signo);
+	}
+	return TW_EVENT_NOOP;
+}
+
+static bool
+signals_watch(struct tw_event_queue *queue, struct tw_event_signals *signals)
+{
+	struct tw_event_source *s;
+	struct tw_event dispatch_all = {
+		.data = queue,
+		.cb = dispatch_signals,
+	};
+	//the mask of an existing signalfd is replaced in place
+	int fd = signalfd(signals->fd, &signals->mask,
+	                  SFD_NONBLOCK | SFD_CLOEXEC);
+
+	if (fd < 0)
+		return false;
+	if (signals->fd >= 0)
+		return true;
+	s = alloc_event_source(queue, &dispatch_all, EPOLLIN | EPOLLET, fd);
+	if (!s) {
+		close(fd);
+		return false;
+	}
+	s->read_size = TW_EVENT_READ_MAX;
+	s->on_read = read_signals;
+	s->kind = TW_TRACE_SOURCE_SIGNAL;
+	if (!insert_event_source(queue, s) ||
+	    !event_source_watch(queue, s)) {
+		//this closes the fd
+		destroy_event_source(queue, s);
+		return false;
+	}
+	signals->fd = fd;
+	return true;
+}
+
+static void
+signals_destroy(struct tw_event_queue *queue)
+{
+	struct tw_event_signals *signals = queue->signals;
+
+	if (!signals)
+		return;
+	//the fd is closed along with its source
+	pthread_sigmask(SIG_UNBLOCK, &signals->blocked, NULL);
+	free(signals);
+	queue->signals = NULL;
+}
+
+WL_EXPORT int
+tw_event_queue_add_signal(struct tw_event_queue *queue, int signo,
+                          struct tw_event *e)
+{
+	struct tw_event_signals *signals;
+	sigset_t set, old;
+
+	//signalfd cannot get these two
+	if (signo < 1 || signo > 64 || signo == SIGKILL || signo == SIGSTOP)
+		return -1;
+	signals = event_signals_get(queue);
+	if (!signals)
+		return -1;
+
+	sigemptyset(&set);
+	if (sigaddset(&set, signo) < 0 ||
+	    pthread_sigmask(SIG_BLOCK, &set, &old))
+		return -1;
+	if (!sigismember(&old, signo))
+		sigaddset(&signals->blocked, signo);
+	sigaddset(&signals->mask, signo);
+	if (!signals_watch(queue, signals)) {
+		tw_event_queue_remove_signal(queue, signo);
+		return -1;
+	}
+	signals->events[signo - 1] = *e;
+	return signo;
+}
+
+WL_EXPORT bool
+tw_event_queue_remove_signal(struct tw_event_queue *queue, int signo)
+{
+	struct tw_event_signals *signals = queue->signals;
+	sigset_t set;
+
+	if (!signals || signo < 1 || signo > 64 ||
+	    !sigismember(&signals->mask, signo))
+		return false;
+	signals->events[signo - 1] = (struct tw_event){0};
+	signals->pending &= ~(1ull << (signo - 1));
+	sigdelset(&signals->mask, signo);
+	if (signals->fd >= 0)
+		signalfd(signals->fd, &signals->mask, 0);
+	if (sigismember(&signals->blocked, signo)) {
+		sigemptyset(&set);
+		sigaddset(&set, signo);
+		sigdelset(&signals->blocked, signo);
+		pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+	}
+	return true;
+}
+
+static void
+close_child(struct tw_event_source *s)
+{
+	close(s->fd);
+	free(s->event.data);
+}
+
+static int
+dispatch_child(struct tw_event *e, int fd)
+{
+	struct tw_event_child *child = e->data;
+	struct tw_event_signals *signals = child->queue->signals;
+	pid_t ret;
+
+	(void)fd;
+	//the pidfd is readable once the child exits, it should not block
+	do {
+		ret = waitpid(child->pid, &child->status, WNOHANG);
+	} while (ret < 0 && errno == EINTR);
+	if (ret == 0)
+		return TW_EVENT_NOOP;
+	//someone else reaped it, we do not know how it ended
+	if (ret < 0)
+		child->status = -1;
+	signals->current = child;
+	if (child->event.cb)
+		child->event.cb(&child->event, child->pid);
+	signals->current = NULL;
+	return TW_EVENT_DEL;
+}
+
+WL_EXPORT int
+tw_event_get_exit_status(struct tw_event_queue *queue, int pid)
+{
+	struct tw_event_signals *signals = queue->signals;
+
+	if (!signals || !signals->current || signals->current->pid != pid)
+		return -1;
+	return signals->current->status;
+}
+
+WL_EXPORT int
+tw_event_queue_spawn(struct tw_event_queue *queue, char *const argv[],
+                     struct tw_event *e)
+{
+	struct tw_event_source *s;
+	struct tw_event_child *child;
+	struct tw_event dispatch_exit = {
+		.cb = dispatch_child,
+	};
+	posix_spawnattr_t attr;
+	sigset_t none, all;
+	pid_t pid;
+	int pidfd, err;
+
+	if (!argv || !argv[0] || !event_signals_get(queue))
+		return -1;
+	child = calloc(1, sizeof(*child));
+	if (!child)
+		return -1;
+	child->event = *e;
+	child->queue = queue;
+
+	//the child should not inherit the signals we block for the signalfd,
+	//nor our handlers
+	sigemptyset(&none);
+	sigfillset(&all);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setsigdefault(&attr, &all);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+	                         POSIX_SPAWN_SETSIGDEF);
+	//glibc spawns with CLONE_VFORK, nothing of our memory is copied
+	err = posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	if (err) {
+		free(child);
+		errno = err;
+		return -1;
+	}
+	child->pid = pid;
+
+	//not reaped yet, the pid cannot be reused under us
+	pidfd = syscall(SYS_pidfd_open, pid, 0);
+	if (pidfd < 0) {
+		free(child);
+		goto err_reap;
+	}
+	dispatch_exit.data = child;
+	s = alloc_event_source(queue, &dispatch_exit, EPOLLIN | EPOLLET,
+	                       pidfd);
+	if (!s) {
+		close(pidfd);
+		free(child);
+		goto err_reap;
+	}
+	s->close = close_child;
+	s->kind = TW_TRACE_SOURCE_CHILD;
+	if (!insert_event_source(queue, s) ||
+	    !event_source_watch(queue, s)) {
+		//this closes the pidfd and frees the child
+		destroy_event_source(queue, s);
+		goto err_reap;
+	}
+	return pid;
+err_reap:
+	//no pidfd or out of memory, the child cannot be watched and should
+	//not become a zombie
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	return -1;
+}
+
+/*******************************************************************************
+ * general source
+ ******************************************************************************/
+
+WL_EXPORT int
+tw_event_queue_add_source(struct tw_event_queue *queue, int fd,
+			  struct tw_event *e, uint32_t mask)
+{
+	struct tw_event_source *s;
+
+	if (!mask)
+		mask = EPOLLIN | EPOLLET;
+	s = event_source_from_fd(queue, fd);
+	if (s) //already added
+		return fd;
+
+	s = alloc_event_source(queue, e, mask, fd);
+	if (!s)
+		return -1;
+
+	if (!insert_event_source(queue, s) ||
+	    !event_source_watch(queue, s)) {
+		destroy_event_source(queue, s);
+		return -1;
+	}
+	return fd;
+}
+
+WL_EXPORT bool
+tw_event_queue_remove_source(struct tw_event_queue *queue, int fd)
+{
+	struct tw_event_source *source =
+		event_source_from_fd(queue, fd);
+
+	if (!source)
+		return false;
+	else {
+		destroy_event_source(queue, source);
+		return true;
+	}
+}
+
+WL_EXPORT bool
+tw_event_queue_modify_source(struct tw_event_queue *queue, int fd,
+                             struct tw_event *e, uint32_t mask)
+{
+	struct tw_event_source *source =
+		event_source_from_fd(queue, fd);
+
+	if (!source)
+		return false;
+	else {
+		source->event = *e;
+		if (queue->uring) {
+			//poll again with the new mask
+			uring_unwatch(queue, source);
+			uring_watch(queue, source);
+		} else {
+			epoll_ctl(queue->pollfd, EPOLL_CTL_MOD, fd,
+			          &source->poll_event);
+		}
+		return true;
+	}
+}
+
+/*******************************************************************************
+ * timer
+ ******************************************************************************/
+
+WL_EXPORT int
+tw_event_queue_add_timer(struct tw_event_queue *queue,
+			 const struct itimerspec *spec, struct tw_event *e)
+{
+	int fd;
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (!fd)
+		goto err;
+	if (timerfd_settime(fd, 0, spec, NULL))
+		goto err_settime;
+	struct tw_event_source *s =
+		alloc_event_source(queue, e, EPOLLIN | EPOLLET, fd);
+	if (!s)
+		goto err_settime;
+	s->read_size = sizeof(uint64_t);
+	s->kind = TW_TRACE_SOURCE_TIMER;
+	//you ahve to read the timmer.
+	if (!insert_event_source(queue, s) ||
+	    !event_source_watch(queue, s))
+		goto err_add;
+
+	return fd;
+
+err_add:
+	destroy_event_source(queue, s);
+err_settime:
+	close(fd);
+err:
+	return -1;
+}
+
+/*******************************************************************************
+ * timer wheel
+ *
+ * timers started by `tw_event_queue_start_timer` live in a hierarchical timer
+ * wheel with 1ms ticks, level N covers 64^(N+1) ticks and gets cascaded into
+ * the lower levels when its slot comes up. All of them share one timerfd,
+ * which we re-arm to the nearest deadline after every dispatch.
+ ******************************************************************************/
+static inline uint64_t
+timer_now_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static inline uint64_t
+timer_timespec_to_ms(const struct timespec *ts)
+{
+	//round up so we never fire early
+	return (uint64_t)ts->tv_sec * 1000 + (ts->tv_nsec + 999999) / 1000000;
+}
+
+static void
+timer_wheel_insert(struct tw_event_timer_wheel *wheel,
+                   struct tw_event_timer *timer)
+{
+	uint64_t expire = MAX(timer->expire, wheel->tick);
+	uint64_t delta = expire - wheel->tick;
+	int level = 0;
+	unsigned int idx;
+
+	while (level < TIMER_WHEEL_LEVELS-1 &&
+	       delta >= (1ull << ((level+1) * TIMER_WHEEL_BITS)))
+		level++;
+	//out of range, it will be cascaded again before it fires
+	if (delta >= TIMER_WHEEL_MAX_DELTA)
+		expire = wheel->tick + TIMER_WHEEL_MAX_DELTA - 1;
+	idx = (expire >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+
+	wl_list_insert(wheel->slots[level][idx].prev, &timer->link);
+	wheel->counts[level]++;
+	timer->level = level;
+	timer->state = TW_TIMER_ON_WHEEL;
+}
+
+static void
+timer_wheel_detach(struct tw_event_timer_wheel *wheel,
+                   struct tw_event_timer *timer)
+{
+	if (timer->state == TW_TIMER_DETACHED)
+		return;
+	if (timer->state == TW_TIMER_ON_WHEEL)
+		wheel->counts[timer->level]--;
+	wl_list_remove(&timer->link);
+	wl_list_init(&timer->link);
+	timer->state = TW_TIMER_DETACHED;
+}
+
+static unsigned int
+timer_wheel_cascade(struct tw_event_timer_wheel *wheel, int level)
+{
+	struct tw_event_timer *timer, *tmp;
+	struct wl_list pending;
+	unsigned int idx = (wheel->tick >> (level * TIMER_WHEEL_BITS)) &
+		TIMER_WHEEL_MASK;
+
+	wl_list_init(&pending);
+	wl_list_insert_list(&pending, &wheel->slots[level][idx]);
+	wl_list_init(&wheel->slots[level][idx]);
+	wl_list_for_each_safe(timer, tmp, &pending, link) {
+		wheel->counts[level]--;
+		timer_wheel_insert(wheel, timer);
+	}
+	return idx;
+}
+
+/**
+ * @brief move all the timers expired at `now` into the expired list.
+ *
+ * We process one tick at a time, but skip the ticks where nothing would happen
+ * so we do not spin through millions of ticks for far away timers.
+ */
+static void
+timer_wheel_advance(struct tw_event_timer_wheel *wheel, uint64_t now)
+{
+	struct tw_event_timer *timer, *tmp;
+
+	while (wheel->tick <= now) {
+		unsigned int idx = wheel->tick & TIMER_WHEEL_MASK;
+		struct wl_list *slot = &wheel->slots[0][idx];
+		int level;
+
+		if (!idx)
+			for (level = 1; level < TIMER_WHEEL_LEVELS &&
+				     !timer_wheel_cascade(wheel, level); level++);
+		wl_list_for_each_safe(timer, tmp, slot, link) {
+			wheel->counts[0]--;
+			wl_list_remove(&timer->link);
+			wl_list_insert(wheel->expired.prev, &timer->link);
+			timer->state = TW_TIMER_EXPIRED;
+		}
+		wheel->tick++;
+
+		if (wheel->counts[0])
+			continue;
+		for (level = 1; level < TIMER_WHEEL_LEVELS; level++)
+			if (wheel->counts[level])
+				break;
+		if (level < TIMER_WHEEL_LEVELS) {
+			uint64_t span = 1ull << (level * TIMER_WHEEL_BITS);
+			uint64_t next = (wheel->tick + span - 1) & ~(span - 1);
+			wheel->tick = MIN(next, now + 1);
+		} else {
+			wheel->tick = MAX(wheel->tick, now + 1);
+		}
+	}
+}
+
+static uint64_t
+timer_wheel_next_expire(struct tw_event_timer_wheel *wheel)
+{
+	struct tw_event_timer *timer;
+	uint64_t next = TIMER_DISARMED;
+
+	if (!wl_list_empty(&wheel->expired))
+		return wheel->tick;
+	for (int i = 0; wheel->counts[0] && i < TIMER_WHEEL_SIZE; i++) {
+		unsigned int idx = (wheel->tick + i) & TIMER_WHEEL_MASK;
+		if (!wl_list_empty(&wheel->slots[0][idx])) {
+			next = wheel->tick + i;
+			break;
+		}
+	}
+	//higher levels are only sorted by slots, the first occupied slot
+	//after current one holds the earliest timers. The current slot may
+	//still hold timers not cascaded yet, so we check it as well.
+	for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		uint64_t base = wheel->tick >> (level * TIMER_WHEEL_BITS);
+		bool found = false;
+
+		for (int i = 0; wheel->counts[level] && i < TIMER_WHEEL_SIZE &&
+			     !found; i++) {
+			struct wl_list *slot =
+				&wheel->slots[level][(base+i) & TIMER_WHEEL_MASK];
+			wl_list_for_each(timer, slot, link) {
+				next = MIN(next, timer->expire);
+				found = i > 0;
+			}
+		}
+	}
+	return next;
+}
+
+static void
+timer_wheel_arm(struct tw_event_timer_wheel *wheel)
+{
+	uint64_t next = timer_wheel_next_expire(wheel);
+	struct itimerspec spec = {0};
+
+	if (next == wheel->armed)
+		return;
+	if (next != TIMER_DISARMED) {
+		//zero it_value disarms the timer
+		next = MAX(next, 1);
+		spec.it_value.tv_sec = next / 1000;
+		spec.it_value.tv_nsec = (next % 1000) * 1000000;
+	}
+	timerfd_settime(wheel->fd, TFD_TIMER_ABSTIME, &spec, NULL);
+	wheel->armed = next;
+}
+
+/* the grids the slacked timers snap to, the coarsest one fitting in the slack
+ * is used, so timers with different slacks still meet on the whole seconds. */
+static const uint32_t timer_slack_grids[] = {1000, 250, 100, 50, 10};
+
+static inline uint64_t
+timer_apply_slack(uint64_t deadline, uint32_t slack)
+{
+	for (unsigned i = 0; i < NUMOF(timer_slack_grids); i++) {
+		uint64_t grid = timer_slack_grids[i];
+		if (slack >= grid)
+			return (deadline + grid - 1) / grid * grid;
+	}
+	return deadline;
+}
+
+static void
+timer_destroy(struct tw_event_queue *queue, struct tw_event_timer *timer)
+{
+	timer_wheel_detach(queue->timers, timer);
+	slab_free(&queue->slabs->timers, timer);
+}
+
+static int
+dispatch_timer_wheel(struct tw_event *e, int fd)
+{
+	struct tw_event_queue *queue = e->data;
+	struct tw_event_timer_wheel *wheel = queue->timers;
+	struct tw_event_timer *timer;
+	uint64_t now = timer_now_ms();
+
+	//timerfd is one-shot, it is disarmed now
+	wheel->armed = TIMER_DISARMED;
+	wheel->dispatching = true;
+	timer_wheel_advance(wheel, now);
+
+	while (!wl_list_empty(&wheel->expired)) {
+		int ret;
+
+		timer = wl_container_of(wheel->expired.next, timer, link);
+		timer_wheel_detach(wheel, timer);
+		timer->firing = true;
+		ret = timer->event.cb(&timer->event, -1);
+		timer->firing = false;
+
+		if (timer->cancelled || ret == TW_EVENT_DEL) {
+			timer_destroy(queue, timer);
+		} else if (timer->state != TW_TIMER_DETACHED) {
+			//re-armed by the callback
+			continue;
+		} else if (timer->interval) {
+			timer->deadline += timer->interval;
+			//we missed some, skip them
+			if (timer->deadline <= now)
+				timer->deadline = now + timer->interval;
+			timer->expire = timer_apply_slack(timer->deadline,
+			                                  timer->slack);
+			timer_wheel_insert(wheel, timer);
+		} else {
+			timer_destroy(queue, timer);
+		}
+	}
+	wheel->dispatching = false;
+	timer_wheel_arm(wheel);
+	return TW_EVENT_NOOP;
+}
+
+static struct tw_event_timer_wheel *
+timer_wheel_create(struct tw_event_queue *queue)
+{
+	struct tw_event_timer_wheel *wheel;
+	struct tw_event dispatch_timers = {
+		.data = queue,
+		.cb = dispatch_timer_wheel,
+	};
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (fd < 0)
+		return NULL;
+	wheel = calloc(1, sizeof(*wheel));
+	if (!wheel) {
+		close(fd);
+		return NULL;
+	}
+	for (int l = 0; l < TIMER_WHEEL_LEVELS; l++)
+		for (int i = 0; i < TIMER_WHEEL_SIZE; i++)
+			wl_list_init(&wheel->slots[l][i]);
+	wl_list_init(&wheel->expired);
+	wheel->tick = timer_now_ms();
+	wheel->armed = TIMER_DISARMED;
+	wheel->fd = fd;
+
+	struct tw_event_source *s =
+		alloc_event_source(queue, &dispatch_timers,
+		                   EPOLLIN | EPOLLET, fd);
+	if (!s) {
+		close(fd);
+		free(wheel);
+		return NULL;
+	}
+	s->kind = TW_TRACE_SOURCE_TIMER;
+	s->read_size = sizeof(uint64_t);
+	if (!insert_event_source(queue, s) ||
+	    !event_source_watch(queue, s)) {
+		//this closes the fd
+		destroy_event_source(queue, s);
+		free(wheel);
+		return NULL;
+	}
+	queue->timers = wheel;
+	return wheel;
+}
+
+static void
+timer_wheel_destroy(struct tw_event_queue *queue)
+{
+	struct tw_event_timer_wheel *wheel = queue->timers;
+	struct tw_event_timer *timer, *tmp;
+
+	if (!wheel)
+		return;
+	for (int l = 0; l < TIMER_WHEEL_LEVELS; l++)
+		for (int i = 0; i < TIMER_WHEEL_SIZE; i++)
+			wl_list_for_each_safe(timer, tmp,
+			                      &wheel->slots[l][i], link)
+				timer_destroy(queue, timer);
+	wl_list_for_each_safe(timer, tmp, &wheel->expired, link)
+		timer_destroy(queue, timer);
+	//the timerfd is closed along with its event source
+	free(wheel);
+	queue->timers = NULL;
+}
+
+static bool
+timer_set_spec(struct tw_event_timer_wheel *wheel,
+               struct tw_event_timer *timer, const struct itimerspec *spec)
+{
+	uint64_t value = timer_timespec_to_ms(&spec->it_value);
+	uint64_t now = timer_now_ms();
+	bool empty = true;
+
+	if (!value)
+		return false;
+	timer_wheel_detach(wheel, timer);
+	for (int l = 0; l < TIMER_WHEEL_LEVELS; l++)
+		empty = empty && !wheel->counts[l];
+	//nothing on the wheel, catch up so new timers land on lower levels
+	if (empty)
+		wheel->tick = MAX(wheel->tick, now);
+	timer->deadline = now + value;
+	timer->expire = timer_apply_slack(timer->deadline, timer->slack);
+	timer->interval = timer_timespec_to_ms(&spec->it_interval);
+	timer_wheel_insert(wheel, timer);
+	if (!wheel->dispatching && timer->expire < wheel->armed)
+		timer_wheel_arm(wheel);
+	return true;
+}
+
+WL_EXPORT struct tw_event_timer *
+tw_event_queue_start_timer(struct tw_event_queue *queue,
+                           const struct itimerspec *spec,
+                           struct tw_event *e)
+{
+	struct tw_event_timer_wheel *wheel = queue->timers;
+	struct tw_event_timer *timer;
+
+	if (!wheel && !(wheel = timer_wheel_create(queue)))
+		return NULL;
+	timer = slab_alloc(&queue->slabs->timers);
+	if (!timer)
+		return NULL;
+	*timer = (struct tw_event_timer){0};
+	wl_list_init(&timer->link);
+	timer->event = *e;
+	timer->state = TW_TIMER_DETACHED;
+	if (!timer_set_spec(wheel, timer, spec)) {
+		slab_free(&queue->slabs->timers, timer);
+		return NULL;
+	}
+	return timer;
+}
+
+WL_EXPORT bool
+tw_event_queue_rearm_timer(struct tw_event_queue *queue,
+                           struct tw_event_timer *timer,
+                           const struct itimerspec *spec)
+{
+	if (!queue->timers || timer->cancelled)
+		return false;
+	return timer_set_spec(queue->timers, timer, spec);
+}
+
+WL_EXPORT void
+tw_event_queue_cancel_timer(struct tw_event_queue *queue,
+                            struct tw_event_timer *timer)
+{
+	if (!queue->timers || !timer)
+		return;
+	//we are inside its callback, dispatch_timer_wheel frees it
+	if (timer->firing) {
+		timer_wheel_detach(queue->timers, timer);
+		timer->cancelled = true;
+		return;
+	}
+	//we do not disarm the timerfd here, at worst we wake up once for
+	//nothing.
+	timer_destroy(queue, timer);
+}
+
+WL_EXPORT void
+tw_event_queue_set_timer_slack(struct tw_event_queue *queue,
+                               struct tw_event_timer *timer, uint32_t slack_ms)
+{
+	struct tw_event_timer_wheel *wheel = queue->timers;
+
+	if (!wheel || !timer)
+		return;
+	timer->slack = slack_ms;
+	if (timer->state != TW_TIMER_ON_WHEEL)
+		return;
+	timer_wheel_detach(wheel, timer);
+	timer->expire = timer_apply_slack(timer->deadline, slack_ms);
+	timer_wheel_insert(wheel, timer);
+	if (!wheel->dispatching)
+		timer_wheel_arm(wheel);
+}
+
+WL_EXPORT int
+tw_event_queue_next_timeout(struct tw_event_queue *queue)
+{
+	struct tw_event_timer_wheel *wheel = queue->timers;
+	uint64_t now;
+
+	//the caller is about to sleep on our fd, so nothing may stay buffered
+	if (queue->wl_display)
+		wl_display_flush(queue->wl_display);
+	if (queue->uring)
+		uring_flush(queue);
+
+	if (event_queue_is_busy(queue))
+		return 0;
+	if (!wheel || wheel->armed == TIMER_DISARMED)
+		return -1;
+	now = timer_now_ms();
+	return wheel->armed > now ? (int)MIN(wheel->armed - now, INT_MAX) : 0;
+}
+
+/*******************************************************************************
+ * wayland display
+ ******************************************************************************/
+
+static int
+dispatch_wl_display(struct tw_event *e, int fd)
+{
+	(void)fd;
+	struct tw_event_queue *queue = e->data;
+	struct wl_display *display = queue->wl_display;
+	while (wl_display_prepare_read(display) != 0)
+		wl_display_dispatch_pending(display);
+	wl_display_flush(display);
+	if (wl_display_read_events(display) == -1)
+		queue->quit = true;
+	//this quit is kinda different
+	if (wl_display_dispatch_pending(display) == -1)
+		queue->quit = true;
+	wl_display_flush(display);
+	return TW_EVENT_NOOP;
+}
+
+WL_EXPORT int
+tw_event_queue_add_wl_display(struct tw_event_queue *queue, struct wl_display *display)
+{
+	int fd = wl_display_get_fd(display);
+	queue->wl_display = display;
+	struct tw_event dispatch_display = {
+		.data = queue,
+		.cb = dispatch_wl_display,
+	};
+	struct tw_event_source *s =
+		alloc_event_source(queue, &dispatch_display,
+		                   EPOLLIN | EPOLLET, fd);
+	if (!s)
+		return -1;
+	//don't close wl_display in the end
+	s->close = NULL;
+	//input and frame events go before everything else
+	s->priority = TW_EVENT_PRIORITY_HIGH;
+	s->kind = TW_TRACE_SOURCE_DISPLAY;
+
+	if (!insert_event_source(queue, s) ||
+	    !event_source_watch(queue, s)) {
+		destroy_event_source(queue, s);
+		return -1;
+	}
+	return fd;
+}
+
+
+/* move a source to another ready list, now if it is waiting already */
+WL_EXPORT bool
+tw_event_queue_set_priority(struct tw_event_queue *queue, int fd,
+                            enum tw_event_priority priority)
+{
+	struct tw_event_source *s = event_source_from_fd(queue, fd);
+
+	if (!s || priority < 0 || priority >= TW_EVENT_PRIORITIES)
+		return false;
+	s->priority = priority;
+	//move it over if it is already waiting
+	if (!wl_list_empty(&s->ready_link)) {
+		wl_list_remove(&s->ready_link);
+		wl_list_insert(queue->ready[priority].prev, &s->ready_link);
+	}
+	return true;
+}
+
+/**
+ * @brief add the idle task to the queue.
+ *
+ * You could have a lot of allocation under one frame. So use this feature
+ * carefully. For example, use a cached state to check whether it is necessary
+ * to add to this list.
+ *
+ * an example of event would be resize event, this event is delegated from
+ * a wl_event.
+ */
+WL_EXPORT bool
+tw_event_queue_add_idle(struct tw_event_queue *queue, struct tw_event *event)
+{
+	struct tw_event_idle *idle = (queue->slabs) ?
+		slab_alloc(&queue->slabs->idle_tasks) : NULL;
+
+	if (!idle)
+		return false;
+	idle->event = *event;
+	idle->key = NULL;
+	wl_list_insert(&queue->idle_tasks, &idle->link);
+	return true;
+}
+
+WL_EXPORT bool
+tw_event_queue_add_idle_once(struct tw_event_queue *queue, const void *key,
+                             struct tw_event *event)
+{
+	struct tw_event_idle **queued, *idle;
+
+	if (!key || !queue->idle_keys)
+		return tw_event_queue_add_idle(queue, event);
+	queued = idle_map_find(queue->idle_keys, key);
+	if (queued) {
+		(*queued)->event = *event;
+		return true;
+	}
+
+	idle = slab_alloc(&queue->slabs->idle_tasks);
+	if (!idle)
+		return false;
+	idle->event = *event;
+	idle->key = key;
+	if (!idle_map_insert(queue->idle_keys, idle)) {
+		slab_free(&queue->slabs->idle_tasks, idle);
+		return false;
+	}
+	wl_list_insert(&queue->idle_tasks, &idle->link);
+	return true;
+}
+
+/*******************************************************************************
+ * cross thread posting
+ *
+ * other threads push their events onto a lock-free stack and kick the eventfd
+ * when the stack was empty, the loop takes the whole stack at once and runs
+ * it in posting order.
+ ******************************************************************************/
+
+static inline struct tw_event_post *
+event_mailbox_take(struct tw_event_mailbox *mailbox)
+{
+	struct tw_event_post *posts, *reversed = NULL;
+
+	posts = atomic_exchange_explicit(&mailbox->head, NULL,
+	                                 memory_order_acquire);
+	while (posts) {
+		struct tw_event_post *next = posts->next;
+		posts->next = reversed;
+		reversed = posts;
+		posts = next;
+	}
+	return reversed;
+}
+
+static int
+dispatch_mailbox(struct tw_event *e, int fd)
+{
+	struct tw_event_queue *queue = e->data;
+	struct tw_event_post *post, *next;
+
+	for (post = event_mailbox_take(queue->mailbox); post; post = next) {
+		next = post->next;
+		post->event.cb(&post->event, -1);
+		free(post);
+	}
+	return TW_EVENT_NOOP;
+}
+
+static bool
+event_mailbox_create(struct tw_event_queue *queue)
+{
+	struct tw_event_source *s;
+	struct tw_event dispatch_posts = {
+		.data = queue,
+		.cb = dispatch_mailbox,
+	};
+	struct tw_event_mailbox *mailbox = calloc(1, sizeof(*mailbox));
+
+	if (!mailbox)
+		return false;
+	atomic_init(&mailbox->head, NULL);
+	mailbox->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (mailbox->fd < 0) {
+		free(mailbox);
+		return false;
+	}
+	s = alloc_event_source(queue, &dispatch_posts, EPOLLIN | EPOLLET,
+	                       mailbox->fd);
+	if (!s) {
+		close(mailbox->fd);
+		free(mailbox);
+		return false;
+	}
+	s->kind = TW_TRACE_SOURCE_POST;
+	s->read_size = sizeof(eventfd_t);
+	if (!insert_event_source(queue, s) ||
+	    !event_source_watch(queue, s)) {
+		//this closes the eventfd
+		destroy_event_source(queue, s);
+		free(mailbox);
+		return false;
+	}
+	queue->mailbox = mailbox;
+	return true;
+}
+
+static void
+event_mailbox_destroy(struct tw_event_queue *queue)
+{
+	struct tw_event_post *post, *next;
+
+	if (!queue->mailbox)
+		return;
+	//drop whatever is not dispatched
+	for (post = event_mailbox_take(queue->mailbox); post; post = next) {
+		next = post->next;
+		free(post);
+	}
+	//the eventfd is closed along with its event source
+	free(queue->mailbox);
+	queue->mailbox = NULL;
+}
+
+WL_EXPORT bool
+tw_event_queue_post(struct tw_event_queue *queue, struct tw_event *event)
+{
+	struct tw_event_mailbox *mailbox = queue->mailbox;
+	struct tw_event_post *post, *head;
+
+	if (!mailbox)
+		return false;
+	post = malloc(sizeof(*post));
+	if (!post)
+		return false;
+	post->event = *event;
+	head = atomic_load_explicit(&mailbox->head, memory_order_relaxed);
+	do {
+		post->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&mailbox->head,
+	                                                &head, post,
+	                                                memory_order_release,
+	                                                memory_order_relaxed));
+	//only the first post after a drain needs to wake up the loop
+	if (!head)
+		eventfd_write(mailbox->fd, 1);
+	return true;
+}
+
+/*******************************************************************************
+ * worker pool
+ *
+ * the works are dealt round robin into the deques of the workers, a worker
+ * runs its own works newest first and steals the oldest works of the others
+ * when it has none. Finished works go to the done list and the loop is poked
+ * through the mailbox when the list was empty.
+ ******************************************************************************/
+
+static struct tw_work *
+work_deque_pop(struct tw_work_deque *deque, bool steal)
+{
+	struct tw_work *work = NULL;
+
+	pthread_mutex_lock(&deque->lock);
+	if (!wl_list_empty(&deque->works)) {
+		work = steal ?
+			wl_container_of(deque->works.next, work, link) :
+			wl_container_of(deque->works.prev, work, link);
+		wl_list_remove(&work->link);
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return work;
+}
+
+static struct tw_work *
+work_pool_take(struct tw_work_worker *worker)
+{
+	struct tw_work_pool *pool = worker->pool;
+	struct tw_work *work = work_deque_pop(&worker->deque, false);
+
+	for (unsigned int i = 1; !work && i < pool->n_workers; i++) {
+		unsigned int victim = (worker->id + i) % pool->n_workers;
+		work = work_deque_pop(&pool->workers[victim].deque, true);
+	}
+	if (work)
+		atomic_fetch_sub_explicit(&pool->pending, 1,
+		                          memory_order_relaxed);
+	return work;
+}
+
+static int
+dispatch_finished_works(struct tw_event *e, int fd)
+{
+	struct tw_work_pool *pool = e->data;
+	struct tw_work *work, *tmp;
+	struct wl_list done;
+
+	wl_list_init(&done);
+	pthread_mutex_lock(&pool->lock);
+	wl_list_insert_list(&done, &pool->done);
+	wl_list_init(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+
+	wl_list_for_each_safe(work, tmp, &done, link) {
+		if (work->done)
+			work->done(work->data, false);
+		free(work);
+	}
+	return TW_EVENT_NOOP;
+}
+
+static void
+work_pool_finish(struct tw_work_pool *pool, struct tw_work *work)
+{
+	bool was_empty;
+	struct tw_event e = {
+		.data = pool,
+		.cb = dispatch_finished_works,
+	};
+
+	pthread_mutex_lock(&pool->lock);
+	was_empty = wl_list_empty(&pool->done);
+	wl_list_insert(pool->done.prev, &work->link);
+	pthread_mutex_unlock(&pool->lock);
+	if (was_empty)
+		tw_event_queue_post(pool->queue, &e);
+}
+
+static void *
+work_pool_thread(void *data)
+{
+	struct tw_work_worker *worker = data;
+	struct tw_work_pool *pool = worker->pool;
+	struct tw_work *work;
+
+	while (true) {
+		pthread_mutex_lock(&pool->lock);
+		while (!atomic_load_explicit(&pool->quit, memory_order_relaxed) &&
+		       !atomic_load_explicit(&pool->pending,
+		                             memory_order_relaxed))
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		if (atomic_load_explicit(&pool->quit, memory_order_relaxed)) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		while ((work = work_pool_take(worker))) {
+			work->work(work->data);
+			work_pool_finish(pool, work);
+			if (atomic_load_explicit(&pool->quit,
+			                         memory_order_relaxed))
+				break;
+		}
+	}
+	return NULL;
+}
+
+static struct tw_work_pool *
+work_pool_create(struct tw_event_queue *queue)
+{
+	struct tw_work_pool *pool;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int n = MAX(1, MIN(ncpus, TW_WORK_MAX_THREADS));
+	sigset_t all, old;
+
+	pool = calloc(1, sizeof(*pool) + n * sizeof(struct tw_work_worker));
+	if (!pool)
+		return NULL;
+	pool->queue = queue;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	atomic_init(&pool->pending, 0);
+	atomic_init(&pool->quit, false);
+	wl_list_init(&pool->done);
+
+	//the signals go to the signalfd of the loop, never to the workers
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (unsigned int i = 0; i < n; i++) {
+		struct tw_work_worker *worker = &pool->workers[i];
+
+		worker->pool = pool;
+		worker->id = i;
+		pthread_mutex_init(&worker->deque.lock, NULL);
+		wl_list_init(&worker->deque.works);
+		if (pthread_create(&worker->thread, NULL, work_pool_thread,
+		                   worker)) {
+			pthread_mutex_destroy(&worker->deque.lock);
+			break;
+		}
+		pool->n_workers++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (!pool->n_workers) {
+		pthread_cond_destroy(&pool->wake);
+		pthread_mutex_destroy(&pool->lock);
+		free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+static void
+work_pool_destroy(struct tw_event_queue *queue)
+{
+	struct tw_work_pool *pool = queue->workers;
+	struct tw_work *work, *tmp;
+
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	atomic_store_explicit(&pool->quit, true, memory_order_relaxed);
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	//the works already running are finished
+	for (unsigned int i = 0; i < pool->n_workers; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	dispatch_finished_works(&(struct tw_event){.data = pool}, -1);
+	for (unsigned int i = 0; i < pool->n_workers; i++) {
+		struct tw_work_deque *deque = &pool->workers[i].deque;
+
+		wl_list_for_each_safe(work, tmp, &deque->works, link) {
+			if (work->done)
+				work->done(work->data, true);
+			free(work);
+		}
+		pthread_mutex_destroy(&deque->lock);
+	}
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+	queue->workers = NULL;
+}
+
+WL_EXPORT bool
+tw_event_queue_submit_work(struct tw_event_queue *queue,
+                           void (*work)(void *data),
+                           void (*done)(void *data, bool cancelled),
+                           void *data)
+{
+	struct tw_work_pool *pool;
+	struct tw_work_deque *deque;
+	struct tw_work *w;
+
+	if (!work || !queue->mailbox)
+		return false;
+	if (!queue->workers && !(queue->workers = work_pool_create(queue)))
+		return false;
+	pool = queue->workers;
+
+	w = malloc(sizeof(*w));
+	if (!w)
+		return false;
+	w->work = work;
+	w->done = done;
+	w->data = data;
+
+	//counted before a worker can take it, or pending wraps below 0. The
+	//workers never hold a deque lock while taking the pool lock
+	deque = &pool->workers[pool->next++ % pool->n_workers].deque;
+	pthread_mutex_lock(&pool->lock);
+	atomic_fetch_add_explicit(&pool->pending, 1, memory_order_relaxed);
+	pthread_mutex_lock(&deque->lock);
+	wl_list_insert(deque->works.prev, &w->link);
+	pthread_mutex_unlock(&deque->lock);
+	pthread_cond_signal(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	return true;
+}
+
+/*******************************************************************************
+ * io_uring backend
+ *
+ * with the ring every source has exactly one request in flight, a read for the
+ * sources needing to be drained and a oneshot poll for the others. Completed
+ * requests are re-armed after the dispatch and go into the kernel with the
+ * next wait, so a wake up costs one io_uring_enter instead of epoll_wait plus
+ * a read per timer.
+ ******************************************************************************/
+#if defined(_TW_HAS_IO_URING)
+
+#define TW_URING_ENTRIES 256
+#define TW_URING_BATCH 32
+
+struct tw_uring_op {
+	struct tw_event_source *source; /**< NULL once the source is gone */
+	bool read;
+	bool armed; /**< in the kernel, its buffer may not be freed */
+	char data[] __attribute__((aligned(8)));
+};
+
+struct tw_event_uring {
+	struct io_uring ring;
+	unsigned int in_flight; /**< ops not completed yet */
+	/* old kernels fail the reads on nonblocking fds with EAGAIN instead
+	 * of waiting, we poll before reading on them */
+	bool poll_reads;
+};
+
+static struct io_uring_sqe *
+uring_get_sqe(struct tw_event_uring *uring)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+
+	//submission queue is full, flush it
+	if (!sqe) {
+		io_uring_submit(&uring->ring);
+		sqe = io_uring_get_sqe(&uring->ring);
+	}
+	return sqe;
+}
+
+static bool
+uring_arm(struct tw_event_uring *uring, struct tw_event_source *s,
+          struct tw_uring_op *op)
 {
-	struct tw_event_source *event_source = malloc(sizeof(struct tw_event_source));
-	wl_list_init(&event_source->link);
-	event_source->event = *e;
-	event_source->poll_event.data.ptr = event_source;
-	event_source->poll_event.events = mask;
-	event_source->fd = fd;
-	event_source->pre_hook = NULL;
-	event_source->close = close_fd;
-	return event_source;
+	struct io_uring_sqe *sqe = uring_get_sqe(uring);
+
+	if (!sqe) {
+		if (s->op == op)
+			s->op = NULL;
+		free(op);
+		return false;
+	}
+	op->source = s;
+	op->armed = true;
+	op->read = s->read_size && !uring->poll_reads;
+	if (op->read)
+		io_uring_prep_read(sqe, s->fd, op->data, s->read_size, 0);
+	else
+		io_uring_prep_poll_add(sqe, s->fd,
+		                       s->poll_event.events & ~EPOLLET);
+	io_uring_sqe_set_data(sqe, op);
+	s->op = op;
+	uring->in_flight++;
+	return true;
 }
 
-static inline void
-destroy_event_source(struct tw_event_source *s)
+static bool
+uring_watch(struct tw_event_queue *queue, struct tw_event_source *s)
 {
-	wl_list_remove(&s->link);
-	if (s->close)
-		s->close(s);
-	free(s);
+	struct tw_uring_op *op = s->op;
+
+	if (op && op->armed)
+		return true;
+	//reuse the op of the last request
+	if (!op)
+		op = malloc(sizeof(*op) + s->read_size);
+	if (!op)
+		return false;
+	return uring_arm(queue->uring, s, op);
 }
 
-static inline struct tw_event_source*
-event_source_from_fd(struct tw_event_queue *queue, int fd)
+static void
+uring_unwatch(struct tw_event_queue *queue, struct tw_event_source *s)
 {
-	struct tw_event_source *pos, *tmp;
-	wl_list_for_each_safe(pos, tmp, &queue->head, link) {
-		if (pos->fd == fd)
-			return pos;
+	struct io_uring_sqe *sqe;
+
+	if (!s->op)
+		return;
+	if (!s->op->armed) {
+		free(s->op);
+		s->op = NULL;
+		return;
 	}
-	return NULL;
+	//the op and its buffer stay around until the request completes
+	s->op->source = NULL;
+	sqe = uring_get_sqe(queue->uring);
+	if (sqe) {
+		io_uring_prep_cancel(sqe, s->op, 0);
+		io_uring_sqe_set_data(sqe, NULL);
+	}
+	s->op = NULL;
 }
 
-void
-tw_event_queue_close(struct tw_event_queue *queue)
+static void
+uring_complete(struct tw_event_queue *queue, struct tw_uring_op *op, int res)
 {
-	struct tw_event_source *event_source, *next;
-	wl_list_for_each_safe(event_source, next, &queue->head, link) {
-		epoll_ctl(queue->pollfd, EPOLL_CTL_DEL, event_source->fd, NULL);
-		destroy_event_source(event_source);
+	struct tw_event_uring *uring = queue->uring;
+	struct tw_event_source *s = op->source;
+
+	uring->in_flight--;
+	op->armed = false;
+	if (!s) {
+		free(op);
+		return;
+	}
+	if (op->read && res == -EAGAIN) {
+		uring->poll_reads = true;
+		uring_arm(uring, s, op);
+		return;
+	}
+	if (op->read && s->on_read) {
+		uint64_t start = stats_now();
+		s->on_read(s, op->data, res);
+		stats_record_read(s, start);
 	}
-	close(queue->pollfd);
+	//the op is re-armed after the dispatch
+	event_source_set_ready(queue, s, !op->read && s->read_size);
 }
 
-WL_EXPORT void
-tw_event_queue_run(struct tw_event_queue *queue)
+static void
+uring_poll(struct tw_event_queue *queue, int timeout)
 {
-	struct epoll_event events[32];
-	struct tw_event_source *event_source;
+	struct tw_event_uring *uring = queue->uring;
+	struct io_uring_cqe *cqes[TW_URING_BATCH];
+	struct tw_uring_op *ops[TW_URING_BATCH];
+	int results[TW_URING_BATCH];
+	unsigned int count;
+	uint64_t start = stats_now();
+	struct __kernel_timespec ts = {
+		.tv_sec = timeout / 1000,
+		.tv_nsec = (timeout % 1000) * 1000000ll,
+	};
 
-	//poll->produce-event-or-timeout
-	while (!queue->quit) {
-		//run the idle task first
-		while (!wl_list_empty(&queue->idle_tasks)) {
-			event_source = container_of(queue->idle_tasks.prev,
-						    struct tw_event_source, link);
-			event_source->event.cb(&event_source->event, 0);
-			destroy_event_source(event_source);
-		}
-		/* wl_display_dispatch_pending(queue->wl_display); */
-
-		if (queue->wl_display)
-			wl_display_flush(queue->wl_display);
-
-		int count = epoll_wait(queue->pollfd, events, 32, -1);
-		//right now if we run into any trouble, we just quit
-		queue->quit = queue->quit && (count != -1);
-		for (int i = 0; i < count; i++) {
-			event_source = events[i].data.ptr;
-			if (event_source->pre_hook)
-				event_source->pre_hook(event_source);
-			int output = event_source->event.cb(
-				&event_source->event,
-				event_source->fd);
-			if (output == TW_EVENT_DEL) {
-				epoll_ctl(queue->pollfd, EPOLL_CTL_DEL,
-					  event_source->fd, NULL);
-				destroy_event_source(event_source);
-			}
+	//this one completes with the first other completion, or times out
+	if (timeout > 0) {
+		struct io_uring_sqe *sqe = uring_get_sqe(uring);
+		if (sqe) {
+			io_uring_prep_timeout(sqe, &ts, 1, 0);
+			io_uring_sqe_set_data(sqe, NULL);
 		}
-
 	}
-	tw_event_queue_close(queue);
-	//udev object is global here. So we destroy it by hand
-	if (UDEV) {
-		udev_unref(UDEV);
-		UDEV = NULL;
+	//submits the re-armed requests as well
+	if (io_uring_submit_and_wait(&uring->ring, timeout ? 1 : 0) < 0)
+		return;
+	stats_record_wait(queue, start);
+	count = io_uring_peek_batch_cqe(&uring->ring, cqes, TW_URING_BATCH);
+	//release the completion queue before we add requests
+	for (unsigned int i = 0; i < count; i++) {
+		ops[i] = io_uring_cqe_get_data(cqes[i]);
+		results[i] = cqes[i]->res;
 	}
-	return;
+	io_uring_cq_advance(&uring->ring, count);
+	//cancel and timeout requests have no op
+	for (unsigned int i = 0; i < count; i++)
+		if (ops[i])
+			uring_complete(queue, ops[i], results[i]);
 }
 
-WL_EXPORT bool
-tw_event_queue_init(struct tw_event_queue *queue)
+static void
+uring_flush(struct tw_event_queue *queue)
 {
-	int fd = epoll_create1(EPOLL_CLOEXEC);
-	if (fd == -1)
-		return false;
-	wl_list_init(&queue->head);
-	wl_list_init(&queue->idle_tasks);
-
-	queue->pollfd = fd;
-	queue->quit = false;
-	return true;
+	io_uring_submit(&queue->uring->ring);
 }
 
-/*******************************************************************************
- * inotify
- ******************************************************************************/
-
-static void
-read_inotify(struct tw_event_source *s)
+static int
+uring_get_fd(struct tw_event_queue *queue)
 {
-	ssize_t r; (void)r;
-	struct inotify_event events[100];
-
-	r = read(s->fd, events, sizeof(events));
+	return queue->uring->ring.ring_fd;
 }
 
-static void
-close_inotify_watch(struct tw_event_source *s)
+static bool
+uring_create(struct tw_event_queue *queue)
 {
-	inotify_rm_watch(s->fd, s->wd);
-	close(s->fd);
+	struct io_uring_probe *probe;
+	struct tw_event_uring *uring = calloc(1, sizeof(*uring));
+	bool supported;
+
+	if (!uring)
+		return false;
+	if (io_uring_queue_init(TW_URING_ENTRIES, &uring->ring, 0) < 0) {
+		free(uring);
+		return false;
+	}
+	probe = io_uring_get_probe_ring(&uring->ring);
+	supported = probe &&
+		io_uring_opcode_supported(probe, IORING_OP_POLL_ADD) &&
+		io_uring_opcode_supported(probe, IORING_OP_READ) &&
+		io_uring_opcode_supported(probe, IORING_OP_TIMEOUT) &&
+		io_uring_opcode_supported(probe, IORING_OP_ASYNC_CANCEL);
+	if (probe)
+		io_uring_free_probe(probe);
+	if (!supported) {
+		io_uring_queue_exit(&uring->ring);
+		free(uring);
+		return false;
+	}
+	queue->uring = uring;
+	return true;
 }
 
-WL_EXPORT int
-tw_event_queue_add_file(struct tw_event_queue *queue, const char *path,
-			struct tw_event *e, uint32_t mask)
+static void
+uring_destroy(struct tw_event_queue *queue)
 {
-	if (!mask)
-		mask = IN_MODIFY | IN_DELETE;
-	if (!is_file_exist(path))
-		return -1;
-	int fd = inotify_init1(IN_CLOEXEC);
-	struct tw_event_source *s = alloc_event_source(e, EPOLLIN | EPOLLET, fd);
-	wl_list_insert(&queue->head, &s->link);
-	s->close = close_inotify_watch;
-	s->pre_hook = read_inotify;
+	struct tw_event_uring *uring = queue->uring;
+	struct io_uring_cqe *cqes[TW_URING_BATCH];
+	unsigned int count;
 
-	if (epoll_ctl(queue->pollfd, EPOLL_CTL_ADD, fd, &s->poll_event)) {
-		destroy_event_source(s);
-		return -1;
+	if (!uring)
+		return;
+	//all the sources are gone, wait for their requests to cancel so the
+	//kernel is not writing into freed buffers
+	while (uring->in_flight &&
+	       io_uring_submit_and_wait(&uring->ring, 1) >= 0) {
+		count = io_uring_peek_batch_cqe(&uring->ring, cqes,
+		                                TW_URING_BATCH);
+		for (unsigned int i = 0; i < count; i++) {
+			struct tw_uring_op *op = io_uring_cqe_get_data(cqes[i]);
+			if (op) {
+				uring->in_flight--;
+				free(op);
+			}
+		}
+		io_uring_cq_advance(&uring->ring, count);
 	}
-	s->wd = inotify_add_watch(fd, path, mask);
-	return fd;
+	io_uring_queue_exit(&uring->ring);
+	free(uring);
+	queue->uring = NULL;
 }
 
-/*******************************************************************************
- * udev
- ******************************************************************************/
+#else
+
+static bool
+uring_create(struct tw_event_queue *queue)
+{
+	return false;
+}
 
 static void
-close_udev_monitor(struct tw_event_source *src)
+uring_destroy(struct tw_event_queue *queue)
 {
-	struct udev_monitor *mon = src->mon;
-	udev_monitor_unref(mon);
 }
 
-WL_EXPORT struct udev_device *
-tw_event_get_udev_device(struct tw_event_queue *queue, int fd)
+static bool
+uring_watch(struct tw_event_queue *queue, struct tw_event_source *s)
 {
-	//this is actually really risky, passing a pointer
-	struct udev_device *dev;
-	const struct tw_event_source *source =
-		event_source_from_fd(queue, fd);
-	if (!source)
-		return NULL;
-	dev = udev_monitor_receive_device(source->mon);
-	return dev;
-	//user has the responsibility to unref it
+	return false;
 }
 
-WL_EXPORT int
-tw_event_queue_add_device(struct tw_event_queue *queue, const char *subsystem,
-			  const char *devname, struct tw_event *e)
+static void
+uring_unwatch(struct tw_event_queue *queue, struct tw_event_source *s)
 {
-	if (!subsystem)
-		return -1;
-	if (!UDEV)
-		UDEV = udev_new();
+}
 
-	struct udev_monitor *mon = udev_monitor_new_from_netlink(UDEV, "udev");
-	udev_monitor_filter_add_match_subsystem_devtype(mon, subsystem, NULL);
-	udev_monitor_enable_receiving(mon);
-	int fd = udev_monitor_get_fd(mon);
+static void
+uring_poll(struct tw_event_queue *queue, int timeout)
+{
+}
 
-	struct tw_event_source *s = alloc_event_source(e, EPOLLIN | EPOLLET, fd);
-	s->mon = mon;
-	s->close = close_udev_monitor;
-	wl_list_insert(&queue->head, &s->link);
+static void
+uring_flush(struct tw_event_queue *queue)
+{
+}
 
-	if (epoll_ctl(queue->pollfd, EPOLL_CTL_ADD, fd, &s->poll_event)) {
-		destroy_event_source(s);
-		return -1;
-	}
-	return fd;
+static int
+uring_get_fd(struct tw_event_queue *queue)
+{
+	return -1;
 }
 
+#endif /* _TW_HAS_IO_URING */
+
 /*******************************************************************************
- * general source
+ * stats query
  ******************************************************************************/
 
-WL_EXPORT int
-tw_event_queue_add_source(struct tw_event_queue *queue, int fd,
-			  struct tw_event *e, uint32_t mask)
+#if defined(_TW_EVENT_STATS)
+
+static void
+dump_hist(FILE *file, const char *name, const struct tw_event_hist *hist)
 {
-	struct tw_event_source *s;
+	if (!hist->count)
+		return;
+	fprintf(file, "  %-10s %8lu calls, mean %8.1f us, max %8.1f us |",
+	        name, (unsigned long)hist->count,
+	        hist->total_ns / 1000.0 / hist->count, hist->max_ns / 1000.0);
+	for (int i = 0; i < TW_EVENT_HIST_BUCKETS; i++)
+		fprintf(file, " %lu", (unsigned long)hist->buckets[i]);
+	fprintf(file, "\n");
+}
 
-	if (!mask)
-		mask = EPOLLIN | EPOLLET;
-	s = event_source_from_fd(queue, fd);
-	if (s) //already added
-		return fd;
+static void
+event_stats_destroy(struct tw_event_queue *queue)
+{
+	//the dump timer goes away with the timer wheel
+	free(queue->stats);
+	queue->stats = NULL;
+}
 
-	s = alloc_event_source(e, mask, fd);
-	wl_list_insert(&queue->head, &s->link);
+static int
+dispatch_stats_dump(struct tw_event *e, int fd)
+{
+	struct tw_event_queue *queue = e->data;
 
-	if (epoll_ctl(queue->pollfd, EPOLL_CTL_ADD, fd, &s->poll_event)) {
-		destroy_event_source(s);
-		return -1;
-	}
-	return fd;
+	tw_event_queue_dump_stats(queue, queue->stats->dump_file);
+	return TW_EVENT_NOOP;
 }
 
 WL_EXPORT bool
-tw_event_queue_remove_source(struct tw_event_queue *queue, int fd)
+tw_event_queue_get_stats(const struct tw_event_queue *queue,
+                         struct tw_event_queue_stats *stats)
 {
-	struct tw_event_source *source =
-		event_source_from_fd(queue, fd);
+	if (!queue->stats)
+		return false;
+	*stats = queue->stats->stats;
+	stats->elapsed_ns = stats_now() - queue->stats->start;
+	return true;
+}
 
-	if (!source)
+WL_EXPORT bool
+tw_event_queue_get_source_stats(const struct tw_event_queue *queue, int fd,
+                                struct tw_event_source_stats *stats)
+{
+	const struct tw_event_source *s =
+		event_source_from_fd((struct tw_event_queue *)queue, fd);
+
+	if (!s)
 		return false;
-	else {
-		epoll_ctl(queue->pollfd, EPOLL_CTL_DEL, source->fd, NULL);
-		destroy_event_source(source);
-		return true;
+	stats->read_time = s->read_time;
+	stats->dispatch_time = s->dispatch_time;
+	return true;
+}
+
+WL_EXPORT void
+tw_event_queue_dump_stats(const struct tw_event_queue *queue, FILE *file)
+{
+	struct tw_event_queue_stats stats;
+	const struct tw_event_source *s;
+	double elapsed;
+
+	if (!tw_event_queue_get_stats(queue, &stats))
+		return;
+	elapsed = MAX(stats.elapsed_ns / 1e9, 1e-9);
+	fprintf(file, "event queue: %.1f wakeups/s, blocked %.1f%% of %.1f s\n",
+	        stats.wakeups / elapsed,
+	        stats.wait_time.total_ns / 1e7 / elapsed, elapsed);
+	dump_hist(file, "wait", &stats.wait_time);
+	dump_hist(file, "idle", &stats.idle_time);
+	wl_list_for_each(s, &queue->head, link) {
+		fprintf(file, " fd %d:\n", s->fd);
+		dump_hist(file, "read", &s->read_time);
+		dump_hist(file, "dispatch", &s->dispatch_time);
 	}
+	fflush(file);
 }
 
 WL_EXPORT bool
-tw_event_queue_modify_source(struct tw_event_queue *queue, int fd,
-                             struct tw_event *e, uint32_t mask)
+tw_event_queue_set_stats_dump(struct tw_event_queue *queue, FILE *file,
+                              uint32_t interval_ms)
 {
-	struct tw_event_source *source =
-		event_source_from_fd(queue, fd);
+	struct itimerspec spec = {
+		.it_value.tv_sec = interval_ms / 1000,
+		.it_value.tv_nsec = (interval_ms % 1000) * 1000000,
+		.it_interval.tv_sec = interval_ms / 1000,
+		.it_interval.tv_nsec = (interval_ms % 1000) * 1000000,
+	};
+	struct tw_event dump = {
+		.data = queue,
+		.cb = dispatch_stats_dump,
+	};
 
-	if (!source)
+	if (!queue->stats)
 		return false;
-	else {
-		source->event = *e;
-		epoll_ctl(queue->pollfd, EPOLL_CTL_MOD, fd, &source->poll_event);
+	if (queue->stats->dump_timer)
+		tw_event_queue_cancel_timer(queue, queue->stats->dump_timer);
+	queue->stats->dump_timer = NULL;
+	queue->stats->dump_file = file;
+	if (!file || !interval_ms)
 		return true;
-	}
+	queue->stats->dump_timer =
+		tw_event_queue_start_timer(queue, &spec, &dump);
+	return queue->stats->dump_timer != NULL;
 }
 
-/*******************************************************************************
- * timer
- ******************************************************************************/
+#else
 
 static void
-read_timer(struct tw_event_source *s)
+event_stats_destroy(struct tw_event_queue *queue)
 {
-	ssize_t r;
-	uint64_t nhit;
-
-	(void)r;
-	(void)nhit;
-	r = read(s->fd, &nhit, 8);
 }
 
-WL_EXPORT int
-tw_event_queue_add_timer(struct tw_event_queue *queue,
-			 const struct itimerspec *spec, struct tw_event *e)
+WL_EXPORT bool
+tw_event_queue_get_stats(const struct tw_event_queue *queue,
+                         struct tw_event_queue_stats *stats)
 {
-	int fd;
-	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (!fd)
-		goto err;
-	if (timerfd_settime(fd, 0, spec, NULL))
-		goto err_settime;
-	struct tw_event_source *s = alloc_event_source(e, EPOLLIN | EPOLLET, fd);
-	s->pre_hook = read_timer;
-	wl_list_insert(&queue->head, &s->link);
-	//you ahve to read the timmer.
-	if (epoll_ctl(queue->pollfd, EPOLL_CTL_ADD, fd, &s->poll_event))
-		goto err_add;
-
-	return fd;
-
-err_add:
-	destroy_event_source(s);
-err_settime:
-	close(fd);
-err:
-	return -1;
+	return false;
 }
 
-/*******************************************************************************
- * wayland display
- ******************************************************************************/
-
-static int
-dispatch_wl_display(struct tw_event *e, int fd)
+WL_EXPORT bool
+tw_event_queue_get_source_stats(const struct tw_event_queue *queue, int fd,
+                                struct tw_event_source_stats *stats)
 {
-	(void)fd;
-	struct tw_event_queue *queue = e->data;
-	struct wl_display *display = queue->wl_display;
-	while (wl_display_prepare_read(display) != 0)
-		wl_display_dispatch_pending(display);
-	wl_display_flush(display);
-	if (wl_display_read_events(display) == -1)
-		queue->quit = true;
-	//this quit is kinda different
-	if (wl_display_dispatch_pending(display) == -1)
-		queue->quit = true;
-	wl_display_flush(display);
-	return TW_EVENT_NOOP;
+	return false;
 }
 
-WL_EXPORT int
-tw_event_queue_add_wl_display(struct tw_event_queue *queue, struct wl_display *display)
+WL_EXPORT void
+tw_event_queue_dump_stats(const struct tw_event_queue *queue, FILE *file)
 {
-	int fd = wl_display_get_fd(display);
-	queue->wl_display = display;
-	struct tw_event dispatch_display = {
-		.data = queue,
-		.cb = dispatch_wl_display,
-	};
-	struct tw_event_source *s = alloc_event_source(&dispatch_display, EPOLLIN | EPOLLET, fd);
-	//don't close wl_display in the end
-	s->close = NULL;
-	wl_list_insert(&queue->head, &s->link);
+}
 
-	if (epoll_ctl(queue->pollfd, EPOLL_CTL_ADD, fd, &s->poll_event)) {
-		destroy_event_source(s);
-		return -1;
-	}
-	return fd;
+WL_EXPORT bool
+tw_event_queue_set_stats_dump(struct tw_event_queue *queue, FILE *file,
+                              uint32_t interval_ms)
+{
+	return false;
 }
 
+#endif /* _TW_EVENT_STATS */
 
-/**
- * @brief add the idle task to the queue.
- *
- * You could have a lot of allocation under one frame. So use this feature
- * carefully. For example, use a cached state to check whether it is necessary
- * to add to this list.
- *
- * an example of event would be resize event, this event is delegated from
- * a wl_event.
- */
-WL_EXPORT bool
-tw_event_queue_add_idle(struct tw_event_queue *queue, struct tw_event *event)
+WL_EXPORT void
+tw_event_queue_get_alloc_stats(const struct tw_event_queue *queue,
+                               struct tw_event_queue_alloc_stats *stats)
 {
-	struct tw_event_source *s = alloc_event_source(event, 0, -1);
-	s->event = *event;
-	wl_list_insert(&queue->idle_tasks, &s->link);
-	return true;
+	*stats = (struct tw_event_queue_alloc_stats){0};
+	if (!queue->slabs)
+		return;
+	stats->sources = queue->slabs->sources.stats;
+	stats->idle_tasks = queue->slabs->idle_tasks.stats;
+	stats->timers = queue->slabs->timers.stats;
 }
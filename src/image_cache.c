@@ -31,6 +31,7 @@
 #include <ctypes/os/file.h>
 
 #include <twclient/image_cache.h>
+#include <twclient/pixel.h>
 #define STB_RECT_PACK_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
@@ -143,25 +144,31 @@ image_load_for_buffer(const char *path, enum wl_shm_format format,
 	int w, h, channels;
 	cairo_surface_t *src_surf, *image_surf;
 	cairo_t *cr;
-	cairo_format_t cairo_format = CAIRO_FORMAT_INVALID;
-
-	//TODO: currently we only support argb888, which is a big waste, it
-	//would be preferable to load them into 565.
-	if (format != WL_SHM_FORMAT_ARGB8888)
+	const struct tw_shm_format_info *info = tw_shm_format_get_info(format);
+	//cairo draws xrgb and argb in place, the rest is converted from argb
+	bool direct = format == WL_SHM_FORMAT_ARGB8888 ||
+		format == WL_SHM_FORMAT_XRGB8888;
+	cairo_format_t cairo_format = format == WL_SHM_FORMAT_XRGB8888 ?
+		CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32;
+	unsigned char *image = mem;
+	uint32_t *pixels = NULL;
+
+	if (!info)
 		goto err_format;
-	cairo_format = CAIRO_FORMAT_ARGB32;
 
 	//you have no choice but to load rgba, cairo deal with 32 bits only
-	uint32_t *pixels = (uint32_t *)image_load(path, &w, &h, &channels);
+	pixels = (uint32_t *)image_load(path, &w, &h, &channels);
 	if (w == 0 || h == 0 || channels == 0 || pixels == NULL)
 		goto err_load;
+	if (!direct && !(image = malloc((size_t)width * height * 4)))
+		goto err_load;
 
 	src_surf = cairo_image_surface_create_for_data(
-		(unsigned char *)pixels, cairo_format,
+		(unsigned char *)pixels, CAIRO_FORMAT_ARGB32,
 		w, h,
-		cairo_format_stride_for_width(cairo_format, w));
+		cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, w));
 	image_surf = cairo_image_surface_create_for_data(
-		(unsigned char *)mem, cairo_format,
+		image, cairo_format,
 		width, height,
 		cairo_format_stride_for_width(cairo_format, width));
 
@@ -175,17 +182,17 @@ image_load_for_buffer(const char *path, enum wl_shm_format format,
 	cairo_surface_destroy(image_surf);
 	cairo_surface_destroy(src_surf);
 
+	if (!direct) {
+		tw_pixel_convert(mem, format, (size_t)width * info->bpp,
+		                 image, WL_SHM_FORMAT_ARGB8888,
+		                 (size_t)width * 4, width, height);
+		free(image);
+	}
 	return true;
 err_load:
-	image_surf = cairo_image_surface_create_for_data(
-		(unsigned char *)mem, cairo_format,
-		width, height,
-		cairo_format_stride_for_width(cairo_format, width));
-	cr = cairo_create(image_surf);
-	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-	cairo_paint(cr);
-	cairo_destroy(cr);
-	cairo_surface_destroy(image_surf);
+	free(pixels);
+	tw_pixel_fill(mem, format, (size_t)width * info->bpp, 0, 0,
+	              width, height, 0xff000000);
 err_format:
 	return false;
 }
@@ -0,0 +1,54 @@
+/*
+ * internal.h - taiwins client private header
+ *
+ * Copyright (c) 2019-2021 Xichen Zhou
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef TW_INTERNAL_H
+#define TW_INTERNAL_H
+
+#include <stdint.h>
+
+/* the functions shared by the sources of the library, not exported */
+
+struct tw_appsurf;
+struct tw_app_event;
+struct tw_event_trace;
+
+void
+_tw_appsurf_run_frame(struct tw_appsurf *surf, const struct tw_app_event *e);
+
+/*******************************************************************************
+ * trace hooks, trace.c
+ ******************************************************************************/
+
+uint64_t
+_tw_trace_now(void);
+
+void
+_tw_trace_record_source(struct tw_event_trace *trace, int kind, int fd,
+                        int output, uint64_t start);
+
+uint64_t
+_tw_trace_app_event_begin(struct tw_event_trace *trace);
+
+void
+_tw_trace_app_event_end(struct tw_event_trace *trace, uint32_t surface_id,
+                        const struct tw_app_event *e, uint64_t start);
+
+#endif /* EOF */
@@ -64,9 +64,11 @@ kc_linux2xkb(uint32_t kc_linux)
 static int
 handle_key_repeat(struct tw_event *e, int fd)
 {
-	struct tw_appsurf *surf = e->data;
-	struct tw_globals *globals = surf->tw_globals;
-	bool repeating = globals && surf->do_frame &&
+	struct tw_globals *globals = e->data;
+	struct wl_surface *focused = globals->inputs.keyboard_focused;
+	struct tw_appsurf *surf = (focused) ?
+		tw_appsurf_from_wl_surface(focused) : NULL;
+	bool repeating = surf && surf->do_frame &&
 		globals->inputs.key_pressed &&
 		e->arg.u == globals->inputs.keysym;
 
@@ -92,8 +94,18 @@ handle_key_repeat(struct tw_event *e, int fd)
 		ae.key.state = true;
 		_tw_appsurf_run_frame(surf, &ae);
 		return TW_EVENT_NOOP;
-	} else
+	} else {
+		globals->inputs.repeat_timer = NULL;
 		return TW_EVENT_DEL;
+	}
+}
+
+static inline void
+stop_key_repeat(struct tw_globals *globals)
+{
+	tw_event_queue_cancel_timer(&globals->event_queue,
+	                            globals->inputs.repeat_timer);
+	globals->inputs.repeat_timer = NULL;
 }
 
 static inline bool
@@ -167,18 +179,21 @@ handle_key(void *data,
 		},
 	};
 
+	//timers on the wheel are cheap, restart it for every key
+	stop_key_repeat(globals);
 	if (is_repeat_info_valid(globals->inputs.repeat_info) &&
 		globals->inputs.key_pressed) {
 		struct tw_event repeat_event = {
-			.data = appsurf,
+			.data = globals,
 			.cb = handle_key_repeat,
 			.arg = {
 				.u = globals->inputs.keysym,
 			},
 		};
-		tw_event_queue_add_timer(&globals->event_queue,
-					 &globals->inputs.repeat_info,
-					 &repeat_event);
+		globals->inputs.repeat_timer =
+			tw_event_queue_start_timer(&globals->event_queue,
+			                           &globals->inputs.repeat_info,
+			                           &repeat_event);
 	}
 	_tw_appsurf_run_frame(appsurf, &e);
 }
@@ -304,6 +319,8 @@ void tw_keyboard_init(struct wl_keyboard *keyboard, struct tw_globals *globals)
 void tw_keyboard_destroy(struct wl_keyboard *keyboard)
 {
 	struct tw_globals *globals = wl_keyboard_get_user_data(keyboard);
+
+	stop_key_repeat(globals);
 	if (globals->inputs.kstate) {
 		xkb_state_unref(globals->inputs.kstate);
 		globals->inputs.kstate = NULL;
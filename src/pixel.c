@@ -0,0 +1,387 @@
+/*
+ * pixel.c - taiwins client pixel format functions
+ *
+ * Copyright (c) 2019-2021 Xichen Zhou
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <string.h>
+#include <wayland-client.h>
+
+#include <twclient/pixel.h>
+
+/*******************************************************************************
+ * format table
+ ******************************************************************************/
+
+#define CH(s, b) {s, b}
+#define NONE {0, 0}
+
+static const struct tw_shm_format_info tw_shm_formats[] = {
+	/* format, bytes per pixel, a, r, g, b */
+	{WL_SHM_FORMAT_ARGB8888, 4, CH(24, 8), CH(16, 8), CH(8, 8), CH(0, 8)},
+	{WL_SHM_FORMAT_XRGB8888, 4, NONE, CH(16, 8), CH(8, 8), CH(0, 8)},
+	{WL_SHM_FORMAT_ABGR8888, 4, CH(24, 8), CH(0, 8), CH(8, 8), CH(16, 8)},
+	{WL_SHM_FORMAT_XBGR8888, 4, NONE, CH(0, 8), CH(8, 8), CH(16, 8)},
+	{WL_SHM_FORMAT_RGBA8888, 4, CH(0, 8), CH(24, 8), CH(16, 8), CH(8, 8)},
+	{WL_SHM_FORMAT_RGBX8888, 4, NONE, CH(24, 8), CH(16, 8), CH(8, 8)},
+	{WL_SHM_FORMAT_BGRA8888, 4, CH(0, 8), CH(8, 8), CH(16, 8), CH(24, 8)},
+	{WL_SHM_FORMAT_BGRX8888, 4, NONE, CH(8, 8), CH(16, 8), CH(24, 8)},
+	{WL_SHM_FORMAT_ARGB2101010, 4, CH(30, 2), CH(20, 10), CH(10, 10), CH(0, 10)},
+	{WL_SHM_FORMAT_XRGB2101010, 4, NONE, CH(20, 10), CH(10, 10), CH(0, 10)},
+	{WL_SHM_FORMAT_ABGR2101010, 4, CH(30, 2), CH(0, 10), CH(10, 10), CH(20, 10)},
+	{WL_SHM_FORMAT_XBGR2101010, 4, NONE, CH(0, 10), CH(10, 10), CH(20, 10)},
+	{WL_SHM_FORMAT_RGB888, 3, NONE, CH(16, 8), CH(8, 8), CH(0, 8)},
+	{WL_SHM_FORMAT_BGR888, 3, NONE, CH(0, 8), CH(8, 8), CH(16, 8)},
+	{WL_SHM_FORMAT_RGB565, 2, NONE, CH(11, 5), CH(5, 6), CH(0, 5)},
+	{WL_SHM_FORMAT_BGR565, 2, NONE, CH(0, 5), CH(5, 6), CH(11, 5)},
+	{WL_SHM_FORMAT_ARGB1555, 2, CH(15, 1), CH(10, 5), CH(5, 5), CH(0, 5)},
+	{WL_SHM_FORMAT_XRGB1555, 2, NONE, CH(10, 5), CH(5, 5), CH(0, 5)},
+	{WL_SHM_FORMAT_ABGR1555, 2, CH(15, 1), CH(0, 5), CH(5, 5), CH(10, 5)},
+	{WL_SHM_FORMAT_XBGR1555, 2, NONE, CH(0, 5), CH(5, 5), CH(10, 5)},
+	{WL_SHM_FORMAT_RGBA5551, 2, CH(0, 1), CH(11, 5), CH(6, 5), CH(1, 5)},
+	{WL_SHM_FORMAT_BGRA5551, 2, CH(0, 1), CH(1, 5), CH(6, 5), CH(11, 5)},
+	{WL_SHM_FORMAT_ARGB4444, 2, CH(12, 4), CH(8, 4), CH(4, 4), CH(0, 4)},
+	{WL_SHM_FORMAT_XRGB4444, 2, NONE, CH(8, 4), CH(4, 4), CH(0, 4)},
+	{WL_SHM_FORMAT_ABGR4444, 2, CH(12, 4), CH(0, 4), CH(4, 4), CH(8, 4)},
+	{WL_SHM_FORMAT_RGBA4444, 2, CH(0, 4), CH(12, 4), CH(8, 4), CH(4, 4)},
+};
+
+#undef CH
+#undef NONE
+
+WL_EXPORT const struct tw_shm_format_info *
+tw_shm_format_get_info(enum wl_shm_format format)
+{
+	for (size_t i = 0; i < sizeof(tw_shm_formats) / sizeof(*tw_shm_formats);
+	     i++)
+		if (tw_shm_formats[i].format == format)
+			return &tw_shm_formats[i];
+	return NULL;
+}
+
+/*******************************************************************************
+ * pixels
+ ******************************************************************************/
+
+static inline uint32_t
+pixel_load(const uint8_t *p, unsigned int bpp)
+{
+	uint32_t v32;
+	uint16_t v16;
+
+	switch (bpp) {
+	case 4:
+		memcpy(&v32, p, 4);
+		return v32;
+	case 2:
+		memcpy(&v16, p, 2);
+		return v16;
+	case 3:
+		return p[0] | p[1] << 8 | p[2] << 16;
+	default:
+		return p[0];
+	}
+}
+
+static inline void
+pixel_store(uint8_t *p, unsigned int bpp, uint32_t v)
+{
+	uint16_t v16 = v;
+
+	switch (bpp) {
+	case 4:
+		memcpy(p, &v, 4);
+		break;
+	case 2:
+		memcpy(p, &v16, 2);
+		break;
+	case 3:
+		p[0] = v;
+		p[1] = v >> 8;
+		p[2] = v >> 16;
+		break;
+	default:
+		p[0] = v;
+	}
+}
+
+/* a channel scaled to 8 bits */
+static inline uint32_t
+channel_get(uint32_t pixel, struct tw_pixel_channel c, uint32_t missing)
+{
+	uint32_t mask = (1u << c.bits) - 1, v;
+
+	if (!c.bits)
+		return missing;
+	v = (pixel >> c.shift) & mask;
+	return c.bits == 8 ? v : (v * 255 + mask / 2) / mask;
+}
+
+static inline uint32_t
+channel_put(uint32_t v, struct tw_pixel_channel c)
+{
+	uint32_t mask = (1u << c.bits) - 1;
+
+	if (!c.bits)
+		return 0;
+	return (c.bits == 8 ? v : (v * mask + 127) / 255) << c.shift;
+}
+
+WL_EXPORT uint32_t
+tw_pixel_pack(const struct tw_shm_format_info *info, uint32_t argb)
+{
+	return channel_put(argb >> 24, info->a) |
+		channel_put((argb >> 16) & 0xff, info->r) |
+		channel_put((argb >> 8) & 0xff, info->g) |
+		channel_put(argb & 0xff, info->b);
+}
+
+WL_EXPORT uint32_t
+tw_pixel_unpack(const struct tw_shm_format_info *info, uint32_t pixel)
+{
+	return channel_get(pixel, info->a, 0xff) << 24 |
+		channel_get(pixel, info->r, 0) << 16 |
+		channel_get(pixel, info->g, 0) << 8 |
+		channel_get(pixel, info->b, 0);
+}
+
+/*******************************************************************************
+ * row kernels
+ *
+ * The common pairs get scalar loops over whole words, with no per channel
+ * shifts. The rest go through ARGB8888 a pixel at a time.
+ ******************************************************************************/
+
+/* xrgb and argb, xbgr and abgr, the alpha byte is there or is 0xff */
+static void
+row_set_alpha(uint32_t *restrict dst, const uint32_t *restrict src,
+              unsigned int n, uint32_t alpha)
+{
+	for (unsigned int i = 0; i < n; i++)
+		dst[i] = src[i] | alpha;
+}
+
+/* argb and abgr */
+static void
+row_swap_rb(uint32_t *restrict dst, const uint32_t *restrict src,
+            unsigned int n, uint32_t alpha)
+{
+	for (unsigned int i = 0; i < n; i++) {
+		uint32_t p = src[i];
+		dst[i] = (p & 0xff00ff00) | ((p >> 16) & 0xff) |
+			((p & 0xff) << 16) | alpha;
+	}
+}
+
+/* any two of the 8 bit channel formats, like rgba and bgra */
+static void
+row_permute_8888(uint32_t *restrict dst, const struct tw_shm_format_info *di,
+                 const uint32_t *restrict src,
+                 const struct tw_shm_format_info *si,
+                 unsigned int n, uint32_t alpha)
+{
+	unsigned int sr = si->r.shift, sg = si->g.shift, sb = si->b.shift;
+	unsigned int sa = si->a.shift, dr = di->r.shift, dg = di->g.shift;
+	unsigned int db = di->b.shift, da = di->a.shift;
+	uint32_t amask = (si->a.bits && di->a.bits) ? 0xff : 0;
+
+	for (unsigned int i = 0; i < n; i++) {
+		uint32_t p = src[i];
+		dst[i] = ((p >> sr) & 0xff) << dr | ((p >> sg) & 0xff) << dg |
+			((p >> sb) & 0xff) << db |
+			((p >> sa) & amask) << da | alpha;
+	}
+}
+
+static void
+row_argb_to_rgb565(uint16_t *restrict dst, const uint32_t *restrict src,
+                   unsigned int n)
+{
+	for (unsigned int i = 0; i < n; i++) {
+		uint32_t p = src[i];
+		dst[i] = ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) |
+			((p >> 3) & 0x001f);
+	}
+}
+
+static void
+row_rgb565_to_argb(uint32_t *restrict dst, const uint16_t *restrict src,
+                   unsigned int n)
+{
+	for (unsigned int i = 0; i < n; i++) {
+		uint32_t p = src[i];
+		uint32_t r = (p >> 11) & 0x1f, g = (p >> 5) & 0x3f, b = p & 0x1f;
+		dst[i] = 0xff000000 | ((r << 3 | r >> 2) << 16) |
+			((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+	}
+}
+
+static void
+row_generic(uint8_t *restrict dst, const struct tw_shm_format_info *di,
+            const uint8_t *restrict src, const struct tw_shm_format_info *si,
+            unsigned int n)
+{
+	for (unsigned int i = 0; i < n; i++) {
+		uint32_t argb = tw_pixel_unpack(si, pixel_load(src, si->bpp));
+		pixel_store(dst, di->bpp, tw_pixel_pack(di, argb));
+		src += si->bpp;
+		dst += di->bpp;
+	}
+}
+
+static inline bool
+format_is_xrgb(const struct tw_shm_format_info *info)
+{
+	return info->bpp == 4 && info->r.shift == 16 && info->r.bits == 8 &&
+		info->b.shift == 0;
+}
+
+static inline bool
+format_is_8888(const struct tw_shm_format_info *info)
+{
+	return info->bpp == 4 && info->r.bits == 8 &&
+		(info->a.bits == 8 || !info->a.bits);
+}
+
+static inline bool
+format_is_xbgr(const struct tw_shm_format_info *info)
+{
+	return info->bpp == 4 && info->r.shift == 0 && info->r.bits == 8 &&
+		info->b.shift == 16;
+}
+
+/* the alpha of the destination, when the source has none */
+static inline uint32_t
+pixel_opaque(const struct tw_shm_format_info *di,
+             const struct tw_shm_format_info *si)
+{
+	return tw_shm_format_has_alpha(si) ? 0 : 0xffu << di->a.shift;
+}
+
+/*******************************************************************************
+ * kernels
+ ******************************************************************************/
+
+WL_EXPORT bool
+tw_pixel_blit(void *dst, size_t dst_stride, unsigned int dx, unsigned int dy,
+              const void *src, size_t src_stride,
+              unsigned int sx, unsigned int sy,
+              enum wl_shm_format format,
+              unsigned int width, unsigned int height)
+{
+	const struct tw_shm_format_info *info = tw_shm_format_get_info(format);
+	uint8_t *d;
+	const uint8_t *s;
+	size_t len;
+
+	if (!info)
+		return false;
+	len = (size_t)width * info->bpp;
+	d = (uint8_t *)dst + dy * dst_stride + dx * info->bpp;
+	s = (const uint8_t *)src + sy * src_stride + sx * info->bpp;
+	//full rows are one block
+	if (len == dst_stride && len == src_stride) {
+		memcpy(d, s, len * height);
+		return true;
+	}
+	for (unsigned int j = 0; j < height; j++) {
+		memcpy(d, s, len);
+		d += dst_stride;
+		s += src_stride;
+	}
+	return true;
+}
+
+WL_EXPORT bool
+tw_pixel_fill(void *dst, enum wl_shm_format format, size_t stride,
+              unsigned int x, unsigned int y,
+              unsigned int width, unsigned int height, uint32_t argb)
+{
+	const struct tw_shm_format_info *info = tw_shm_format_get_info(format);
+	uint32_t v;
+	uint8_t *row;
+
+	if (!info)
+		return false;
+	v = tw_pixel_pack(info, argb);
+	row = (uint8_t *)dst + y * stride + x * info->bpp;
+	for (unsigned int j = 0; j < height; j++, row += stride) {
+		if (info->bpp == 4) {
+			uint32_t *p = (uint32_t *)row;
+			for (unsigned int i = 0; i < width; i++)
+				p[i] = v;
+		} else if (info->bpp == 2) {
+			uint16_t *p = (uint16_t *)row;
+			for (unsigned int i = 0; i < width; i++)
+				p[i] = v;
+		} else {
+			for (unsigned int i = 0; i < width; i++)
+				pixel_store(row + i * info->bpp, info->bpp, v);
+		}
+	}
+	return true;
+}
+
+WL_EXPORT bool
+tw_pixel_convert(void *dst, enum wl_shm_format dst_format, size_t dst_stride,
+                 const void *src, enum wl_shm_format src_format,
+                 size_t src_stride, unsigned int width, unsigned int height)
+{
+	const struct tw_shm_format_info *di = tw_shm_format_get_info(dst_format);
+	const struct tw_shm_format_info *si = tw_shm_format_get_info(src_format);
+	uint32_t alpha;
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	if (!di || !si)
+		return false;
+	if (di == si)
+		return tw_pixel_blit(dst, dst_stride, 0, 0, src, src_stride,
+		                     0, 0, dst_format, width, height);
+	//an opaque source gets an opaque alpha
+	alpha = tw_shm_format_has_alpha(si) ? 0 : 0xff000000;
+
+	for (unsigned int j = 0; j < height; j++) {
+		if ((format_is_xrgb(di) && format_is_xrgb(si)) ||
+		    (format_is_xbgr(di) && format_is_xbgr(si)))
+			row_set_alpha((uint32_t *)d, (const uint32_t *)s,
+			              width, alpha);
+		else if ((format_is_xrgb(di) && format_is_xbgr(si)) ||
+		         (format_is_xbgr(di) && format_is_xrgb(si)))
+			row_swap_rb((uint32_t *)d, (const uint32_t *)s,
+			            width, alpha);
+		else if (format_is_8888(di) && format_is_8888(si))
+			row_permute_8888((uint32_t *)d, di, (const uint32_t *)s,
+			                 si, width,
+			                 tw_shm_format_has_alpha(di) ?
+			                 pixel_opaque(di, si) : 0);
+		else if (dst_format == WL_SHM_FORMAT_RGB565 &&
+		         format_is_xrgb(si))
+			row_argb_to_rgb565((uint16_t *)d, (const uint32_t *)s,
+			                   width);
+		else if (format_is_xrgb(di) &&
+		         src_format == WL_SHM_FORMAT_RGB565)
+			row_rgb565_to_argb((uint32_t *)d, (const uint16_t *)s,
+			                   width);
+		else
+			row_generic(d, di, s, si, width);
+		d += dst_stride;
+		s += src_stride;
+	}
+	return true;
+}
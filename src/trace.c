@@ -0,0 +1,363 @@
+/*
+ * trace.c - taiwins client event trace functions
+ *
+ * Copyright (c) 2019-2021 Xichen Zhou
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wayland-client.h>
+
+#include <twclient/event_queue.h>
+#include <twclient/ui.h>
+#include <twclient/trace.h>
+
+#include "internal.h"
+
+/* the stdio buffer of the trace, so we write once in a while */
+#define TW_TRACE_BUFFER_SIZE (64 * 1024)
+
+struct tw_event_trace {
+	FILE *file;
+	uint64_t start_ns;
+	/* app events running inside another one are not recorded, the replay
+	 * gets them from the outer one */
+	int depth;
+	char buffer[TW_TRACE_BUFFER_SIZE];
+};
+
+uint64_t
+_tw_trace_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* the payload comes in two parts, the fixed one and the variable one */
+static void
+trace_write(struct tw_event_trace *trace, struct tw_trace_record *record,
+            uint64_t start, const void *payload, uint32_t size,
+            const void *extra, uint32_t extra_size)
+{
+	uint64_t now = _tw_trace_now();
+
+	record->time_ns = start - trace->start_ns;
+	record->duration_ns = now - start;
+	record->size = size + extra_size;
+	//a short write only loses the tail of the trace
+	if (fwrite(record, sizeof(*record), 1, trace->file) != 1)
+		return;
+	if (size)
+		fwrite(payload, size, 1, trace->file);
+	if (extra_size)
+		fwrite(extra, extra_size, 1, trace->file);
+}
+
+void
+_tw_trace_record_source(struct tw_event_trace *trace, int kind, int fd,
+                        int output, uint64_t start)
+{
+	struct tw_trace_record record = {
+		.kind = TW_TRACE_SOURCE,
+		.subtype = kind,
+		.id = fd,
+		.output = output,
+	};
+
+	trace_write(trace, &record, start, NULL, 0, NULL, 0);
+}
+
+/*******************************************************************************
+ * app events
+ ******************************************************************************/
+
+static const char *
+trace_pack_app_event(const struct tw_app_event *e,
+                     struct tw_trace_app_event *packed)
+{
+	uint32_t *args = packed->args;
+
+	*packed = (struct tw_trace_app_event){
+		.time = e->time,
+	};
+	switch (e->type) {
+	case TW_KEY_BTN:
+		args[0] = e->key.code;
+		args[1] = e->key.sym;
+		args[2] = e->key.mod;
+		args[3] = e->key.state;
+		break;
+	case TW_POINTER_MOTION:
+	case TW_POINTER_BTN:
+		args[0] = e->ptr.mod;
+		args[1] = e->ptr.x;
+		args[2] = e->ptr.y;
+		args[3] = e->ptr.btn;
+		args[4] = e->ptr.state;
+		break;
+	case TW_POINTER_AXIS:
+		args[0] = e->axis.mod;
+		args[1] = (uint32_t)e->axis.dx;
+		args[2] = (uint32_t)e->axis.dy;
+		break;
+	case TW_TOUCH_MOTION:
+		args[0] = e->touch.mod;
+		break;
+	case TW_RESIZE:
+	case TW_FULLSCREEN:
+	case TW_MINIMIZE:
+		args[0] = e->resize.edge;
+		args[1] = e->resize.nw;
+		args[2] = e->resize.nh;
+		args[3] = e->resize.ns;
+		args[4] = e->resize.serial;
+		break;
+	case TW_PASTE:
+		packed->extra = e->clipboard.data ? e->clipboard.size : 0;
+		return e->clipboard.data;
+	case TW_COPY:
+		packed->extra = e->clipboard_source.mime_type ?
+			strlen(e->clipboard_source.mime_type) + 1 : 0;
+		return e->clipboard_source.mime_type;
+	default:
+		break;
+	}
+	return NULL;
+}
+
+static void
+trace_unpack_app_event(struct tw_app_event *e, uint16_t type,
+                       const struct tw_trace_app_event *packed,
+                       void *extra)
+{
+	const uint32_t *args = packed->args;
+
+	*e = (struct tw_app_event){
+		.type = type,
+		.time = packed->time,
+	};
+	switch (e->type) {
+	case TW_KEY_BTN:
+		e->key.code = args[0];
+		e->key.sym = args[1];
+		e->key.mod = args[2];
+		e->key.state = args[3];
+		break;
+	case TW_POINTER_MOTION:
+	case TW_POINTER_BTN:
+		e->ptr.mod = args[0];
+		e->ptr.x = args[1];
+		e->ptr.y = args[2];
+		e->ptr.btn = args[3];
+		e->ptr.state = args[4];
+		break;
+	case TW_POINTER_AXIS:
+		e->axis.mod = args[0];
+		e->axis.dx = (int)args[1];
+		e->axis.dy = (int)args[2];
+		break;
+	case TW_TOUCH_MOTION:
+		e->touch.mod = args[0];
+		break;
+	case TW_RESIZE:
+	case TW_FULLSCREEN:
+	case TW_MINIMIZE:
+		e->resize.edge = args[0];
+		e->resize.nw = args[1];
+		e->resize.nh = args[2];
+		e->resize.ns = args[3];
+		e->resize.serial = args[4];
+		break;
+	case TW_PASTE:
+		e->clipboard.data = extra;
+		e->clipboard.size = packed->extra;
+		break;
+	case TW_COPY:
+		//there is nobody to write to
+		e->clipboard_source.mime_type = extra;
+		e->clipboard_source.write_fd = -1;
+		break;
+	default:
+		break;
+	}
+}
+
+uint64_t
+_tw_trace_app_event_begin(struct tw_event_trace *trace)
+{
+	trace->depth++;
+	return _tw_trace_now();
+}
+
+void
+_tw_trace_app_event_end(struct tw_event_trace *trace, uint32_t surface_id,
+                        const struct tw_app_event *e, uint64_t start)
+{
+	struct tw_trace_app_event packed;
+	const char *extra;
+	struct tw_trace_record record = {
+		.kind = TW_TRACE_APP_EVENT,
+		.subtype = e->type,
+		.id = (int32_t)surface_id,
+	};
+
+	if (--trace->depth > 0)
+		return;
+	extra = trace_pack_app_event(e, &packed);
+	trace_write(trace, &record, start, &packed, sizeof(packed),
+	            extra, packed.extra);
+}
+
+/*******************************************************************************
+ * recording
+ ******************************************************************************/
+
+WL_EXPORT bool
+tw_event_queue_start_trace(struct tw_event_queue *queue, const char *path)
+{
+	struct tw_event_trace *trace;
+	struct tw_trace_header header = {
+		.magic = TW_TRACE_MAGIC,
+		.version = TW_TRACE_VERSION,
+	};
+
+	trace = calloc(1, sizeof(*trace));
+	if (!trace)
+		return false;
+	trace->file = fopen(path, "wb");
+	if (!trace->file) {
+		free(trace);
+		return false;
+	}
+	setvbuf(trace->file, trace->buffer, _IOFBF, sizeof(trace->buffer));
+	trace->start_ns = _tw_trace_now();
+	header.start_ns = trace->start_ns;
+	if (fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+		fclose(trace->file);
+		free(trace);
+		return false;
+	}
+	tw_event_queue_stop_trace(queue);
+	queue->trace = trace;
+	return true;
+}
+
+WL_EXPORT void
+tw_event_queue_stop_trace(struct tw_event_queue *queue)
+{
+	struct tw_event_trace *trace = queue->trace;
+
+	if (!trace)
+		return;
+	queue->trace = NULL;
+	//flushes the buffer we gave it
+	fclose(trace->file);
+	free(trace);
+}
+
+/*******************************************************************************
+ * replay
+ ******************************************************************************/
+
+static void
+trace_sleep_until(uint64_t deadline_ns)
+{
+	struct timespec ts = {
+		.tv_sec = deadline_ns / 1000000000,
+		.tv_nsec = deadline_ns % 1000000000,
+	};
+
+	//it returns the error rather than setting errno
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+WL_EXPORT bool
+tw_trace_replay(const char *path, struct tw_appsurf *surf,
+                uint32_t surface_id, uint32_t flags,
+                struct tw_trace_replay_stats *stats)
+{
+	struct tw_trace_header header;
+	struct tw_trace_record record;
+	struct tw_trace_app_event packed;
+	struct tw_app_event event;
+	uint64_t replay_start, start, elapsed;
+	void *extra = NULL;
+	size_t extra_cap = 0;
+	bool ok = false;
+	FILE *file = fopen(path, "rb");
+
+	if (!file)
+		return false;
+	*stats = (struct tw_trace_replay_stats){0};
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    header.magic != TW_TRACE_MAGIC ||
+	    header.version != TW_TRACE_VERSION)
+		goto out;
+
+	replay_start = _tw_trace_now();
+	while (fread(&record, sizeof(record), 1, file) == 1) {
+		if (record.kind != TW_TRACE_APP_EVENT ||
+		    (surface_id && (uint32_t)record.id != surface_id) ||
+		    record.size < sizeof(packed)) {
+			if (record.kind == TW_TRACE_SOURCE)
+				stats->sources++;
+			if (fseek(file, record.size, SEEK_CUR))
+				goto out;
+			continue;
+		}
+		if (fread(&packed, sizeof(packed), 1, file) != 1 ||
+		    packed.extra != record.size - sizeof(packed))
+			goto out;
+		if (packed.extra > extra_cap) {
+			void *grown = realloc(extra, packed.extra);
+			if (!grown)
+				goto out;
+			extra = grown;
+			extra_cap = packed.extra;
+		}
+		if (packed.extra && fread(extra, packed.extra, 1, file) != 1)
+			goto out;
+		trace_unpack_app_event(&event, record.subtype, &packed,
+		                       packed.extra ? extra : NULL);
+
+		if (flags & TW_TRACE_REPLAY_TIMED)
+			trace_sleep_until(replay_start + record.time_ns);
+		start = _tw_trace_now();
+		_tw_appsurf_run_frame(surf, &event);
+		elapsed = _tw_trace_now() - start;
+
+		stats->events++;
+		stats->recorded_ns += record.duration_ns;
+		stats->total_ns += elapsed;
+		if (elapsed > stats->max_ns)
+			stats->max_ns = elapsed;
+	}
+	//a trace cut short by a crash is still good up to there
+	ok = true;
+out:
+	free(extra);
+	fclose(file);
+	return ok;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include <twclient/event_queue.h>
+
+/* register and remove N sources, the per-operation cost should stay flat as N
+ * grows. */
+
+static int
+dummy_callback(struct tw_event *e, int fd)
+{
+	(void)e;
+	(void)fd;
+	return TW_EVENT_NOOP;
+}
+
+static struct tw_event event = {
+	.data = NULL,
+	.cb = dummy_callback,
+};
+
+static inline double
+elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 +
+		(end->tv_nsec - start->tv_nsec);
+}
+
+static void
+bench_sources(int n)
+{
+	struct tw_event_queue queue = {0};
+	struct timespec t0, t1, t2, t3;
+	int *fds = calloc(n, sizeof(int));
+
+	tw_event_queue_init(&queue);
+	for (int i = 0; i < n; i++)
+		fds[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0; i < n; i++)
+		tw_event_queue_add_source(&queue, fds[i], &event, 0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	//adding existing fds only runs the lookup
+	for (int i = 0; i < n; i++)
+		tw_event_queue_add_source(&queue, fds[i], &event, 0);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	//remove_source closes the fds
+	for (int i = n-1; i >= 0; i--)
+		tw_event_queue_remove_source(&queue, fds[i]);
+	clock_gettime(CLOCK_MONOTONIC, &t3);
+
+	fprintf(stdout, "%6d sources: add %8.1f ns/op, lookup %8.1f ns/op, "
+	        "remove %8.1f ns/op\n", n,
+	        elapsed_ns(&t0, &t1) / n,
+	        elapsed_ns(&t1, &t2) / n,
+	        elapsed_ns(&t2, &t3) / n);
+
+	tw_event_queue_close(&queue);
+	free(fds);
+}
+
+int main(int argc, char *argv[])
+{
+	int max = argc > 1 ? atoi(argv[1]) : 10000;
+	struct rlimit limit;
+
+	//we need a lot of fds for this
+	if (!getrlimit(RLIMIT_NOFILE, &limit)) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+		if (limit.rlim_cur < (rlim_t)max + 64)
+			max = (int)limit.rlim_cur - 64;
+	}
+	for (int n = 1000; n <= max; n *= 2)
+		bench_sources(n);
+	bench_sources(max);
+	return 0;
+}
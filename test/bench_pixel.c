@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <twclient/pixel.h>
+
+/* convert a 4K ARGB8888 frame to other formats and back, the round trip should
+ * keep the 8 bit formats exact. */
+
+#define WIDTH 3840
+#define HEIGHT 2160
+
+static inline double
+elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e3 +
+		(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	enum wl_shm_format formats[] = {
+		WL_SHM_FORMAT_XRGB8888,
+		WL_SHM_FORMAT_ABGR8888,
+		WL_SHM_FORMAT_RGBA8888,
+		WL_SHM_FORMAT_RGB888,
+		WL_SHM_FORMAT_RGB565,
+		WL_SHM_FORMAT_ARGB4444,
+	};
+	uint32_t *frame = malloc(WIDTH * HEIGHT * 4);
+	uint32_t *back = malloc(WIDTH * HEIGHT * 4);
+	uint8_t *converted = malloc(WIDTH * HEIGHT * 4);
+	struct timespec t0, t1, t2;
+
+	//opaque, so formats without alpha come back the same
+	for (int i = 0; i < WIDTH * HEIGHT; i++)
+		frame[i] = 0xff000000 | (i * 2654435761u >> 8);
+
+	for (unsigned i = 0; i < sizeof(formats) / sizeof(*formats); i++) {
+		const struct tw_shm_format_info *info =
+			tw_shm_format_get_info(formats[i]);
+		size_t stride = WIDTH * info->bpp;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		tw_pixel_convert(converted, formats[i], stride,
+		                 frame, WL_SHM_FORMAT_ARGB8888, WIDTH * 4,
+		                 WIDTH, HEIGHT);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		tw_pixel_convert(back, WL_SHM_FORMAT_ARGB8888, WIDTH * 4,
+		                 converted, formats[i], stride,
+		                 WIDTH, HEIGHT);
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+
+		fprintf(stdout, "%08x: to %7.2f ms, from %7.2f ms, %s\n",
+		        formats[i], elapsed_ms(&t0, &t1), elapsed_ms(&t1, &t2),
+		        memcmp(frame, back, WIDTH * HEIGHT * 4) ?
+		        "lossy" : "exact");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	tw_pixel_fill(frame, WL_SHM_FORMAT_ARGB8888, WIDTH * 4, 0, 0,
+	              WIDTH, HEIGHT, 0xff202020);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(stdout, "fill: %7.2f ms\n", elapsed_ms(&t0, &t1));
+
+	free(frame);
+	free(back);
+	free(converted);
+	return 0;
+}
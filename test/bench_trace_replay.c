@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <cairo/cairo.h>
+
+#include <twclient/ui.h>
+#include <twclient/trace.h>
+
+/* replay a trace recorded with tw_event_queue_start_trace into a surface
+ * painting with cairo in memory, run it twice to compare draw paths. */
+
+static cairo_surface_t *image;
+
+static void
+paint_frame(struct tw_appsurf *surf, const struct tw_app_event *e)
+{
+	cairo_t *cr;
+
+	if (e->type == TW_RESIZE) {
+		surf->allocation.w = e->resize.nw;
+		surf->allocation.h = e->resize.nh;
+		surf->allocation.s = e->resize.ns ? e->resize.ns : 1;
+		cairo_surface_destroy(image);
+		image = NULL;
+	}
+	if (!image)
+		image = cairo_image_surface_create(
+			CAIRO_FORMAT_ARGB32,
+			surf->allocation.w * surf->allocation.s,
+			surf->allocation.h * surf->allocation.s);
+	cr = cairo_create(image);
+	cairo_set_source_rgba(cr, 0.2, 0.2, 0.2, 0.9);
+	cairo_paint(cr);
+	if (e->type == TW_POINTER_MOTION || e->type == TW_POINTER_BTN) {
+		cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+		cairo_arc(cr, e->ptr.x, e->ptr.y, 16, 0, 6.2832);
+		cairo_fill(cr);
+	}
+	cairo_destroy(cr);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tw_appsurf surf = {0};
+	struct tw_trace_replay_stats stats;
+	uint32_t id = argc > 2 ? atoi(argv[2]) : 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s trace [surface-id]\n", argv[0]);
+		return 1;
+	}
+	wl_list_init(&surf.filter_head);
+	surf.allocation = (struct tw_bbox){.w = 400, .h = 300, .s = 1};
+	surf.do_frame = paint_frame;
+
+	for (int i = 0; i < 2; i++) {
+		if (!tw_trace_replay(argv[1], &surf, id, 0, &stats)) {
+			fprintf(stderr, "cannot replay %s\n", argv[1]);
+			return 1;
+		}
+		fprintf(stdout, "%u events (%u sources): recorded %.3f ms, "
+		        "replayed %.3f ms, slowest %.3f ms\n",
+		        stats.events, stats.sources,
+		        stats.recorded_ns / 1e6, stats.total_ns / 1e6,
+		        stats.max_ns / 1e6);
+	}
+	cairo_surface_destroy(image);
+	return 0;
+}
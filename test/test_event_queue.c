@@ -3,11 +3,19 @@
 #include <twclient/client.h>
 #include <sys/inotify.h>
 
+static struct tw_event_queue queue = {0};
+
 int recieve_callback(struct tw_event *e, int fd)
 {
+	size_t n;
+	const struct tw_event_file_change *changes =
+		tw_event_get_file_changes(&queue, fd, &n);
 	(void)e;
-	(void)fd;
-	fprintf(stderr, "I recieved a event\n");
+
+	fprintf(stderr, "I recieved %zu events\n", n);
+	for (size_t i = 0; i < n; i++)
+		fprintf(stderr, "\tmask %x name %s\n", changes[i].mask,
+		        changes[i].name ? changes[i].name : "");
 	return TW_EVENT_NOOP;
 }
 
@@ -20,7 +28,6 @@ struct tw_event event = {
 
 int main(int argc, char *argv[])
 {
-	struct tw_event_queue queue = {0};
 	tw_event_queue_init(&queue);
 	/* int fd = open(file, O_RDONLY); */
 	tw_event_queue_add_file(&queue, argv[1], &event, 0);
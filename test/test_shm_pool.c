@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#include <twclient/shmpool.h>
+
+/* the sub-allocator of the shm pool: the freed space is reused, a buffer goes
+ * in the smallest hole it fits and the holes merge back into one range. Needs
+ * a compositor for the wl_shm. */
+
+static struct wl_shm *shm;
+static size_t page;
+static int failures;
+
+#define check(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, __VA_ARGS__); \
+			failures++; \
+		} \
+	} while (0)
+
+static void
+handle_global(void *data, struct wl_registry *registry, uint32_t name,
+              const char *interface, uint32_t version)
+{
+	(void)data;
+	if (strcmp(interface, wl_shm_interface.name) == 0)
+		shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+}
+
+static void
+handle_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+	(void)data;
+	(void)registry;
+	(void)name;
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = handle_global,
+	.global_remove = handle_global_remove,
+};
+
+/* ARGB8888 rows of a page, so a buffer of `pages` rows is `pages` pages */
+static struct wl_buffer *
+alloc_pages(struct tw_shm_pool *pool, size_t pages)
+{
+	return tw_shm_pool_alloc_buffer(pool, page / 4, pages);
+}
+
+static void
+test_reuse_and_best_fit(void)
+{
+	struct tw_shm_pool pool;
+	struct wl_buffer *a, *b, *c, *d, *e, *x, *y;
+	char *addr_b, *addr_d;
+
+	tw_shm_pool_init(&pool, shm, 64 * page, WL_SHM_FORMAT_ARGB8888);
+	//a 8 | b 4 | c 8 | d 2 | e 8 | tail
+	a = alloc_pages(&pool, 8);
+	b = alloc_pages(&pool, 4);
+	c = alloc_pages(&pool, 8);
+	d = alloc_pages(&pool, 2);
+	e = alloc_pages(&pool, 8);
+	addr_b = tw_shm_pool_buffer_access(b);
+	addr_d = tw_shm_pool_buffer_access(d);
+
+	//reuse, the same space comes back
+	tw_shm_pool_buffer_free(b);
+	b = alloc_pages(&pool, 4);
+	check(tw_shm_pool_buffer_access(b) == addr_b,
+	      "freed space of b is not reused\n");
+
+	//best fit, the 2 pages hole before the 4 pages one and the tail
+	tw_shm_pool_buffer_free(b);
+	tw_shm_pool_buffer_free(d);
+	x = alloc_pages(&pool, 2);
+	check(tw_shm_pool_buffer_access(x) == addr_d,
+	      "2 pages did not go in the 2 pages hole\n");
+	y = alloc_pages(&pool, 3);
+	check(tw_shm_pool_buffer_access(y) == addr_b,
+	      "3 pages did not go in the 4 pages hole\n");
+
+	tw_shm_pool_buffer_free(a);
+	tw_shm_pool_buffer_free(c);
+	tw_shm_pool_buffer_free(e);
+	tw_shm_pool_buffer_free(x);
+	tw_shm_pool_buffer_free(y);
+	tw_shm_pool_release(&pool);
+}
+
+static void
+test_coalescing(void)
+{
+	struct tw_shm_pool pool;
+	struct tw_shm_pool_stats stats;
+	struct wl_buffer *a, *b, *c;
+
+	tw_shm_pool_init(&pool, shm, 32 * page, WL_SHM_FORMAT_ARGB8888);
+	a = alloc_pages(&pool, 4);
+	b = alloc_pages(&pool, 4);
+	c = alloc_pages(&pool, 4);
+
+	//a and the tail with c, b in between
+	tw_shm_pool_buffer_free(a);
+	tw_shm_pool_buffer_free(c);
+	tw_shm_pool_get_stats(&pool, &stats);
+	check(stats.free_ranges == 2, "%zu free ranges, 2 expected\n",
+	      stats.free_ranges);
+	check(stats.used == 4 * page, "%zu bytes used\n", stats.used);
+
+	//b joins both of them
+	tw_shm_pool_buffer_free(b);
+	tw_shm_pool_get_stats(&pool, &stats);
+	check(stats.free_ranges == 1, "%zu free ranges, 1 expected\n",
+	      stats.free_ranges);
+	check(stats.largest_free == stats.size,
+	      "largest free %zu of %zu\n", stats.largest_free, stats.size);
+	check(stats.fragmentation == 0.0f, "fragmentation %f\n",
+	      stats.fragmentation);
+	check(stats.high_water == 12 * page, "high water %zu\n",
+	      stats.high_water);
+
+	//the whole pool in one buffer, no growth needed
+	a = alloc_pages(&pool, stats.size / page);
+	tw_shm_pool_get_stats(&pool, &stats);
+	check(a && stats.free_ranges == 0, "the merged pool does not fit\n");
+	tw_shm_pool_buffer_free(a);
+	tw_shm_pool_release(&pool);
+}
+
+int main(int argc, char *argv[])
+{
+	struct wl_display *display = wl_display_connect(NULL);
+	struct wl_registry *registry;
+
+	if (!display) {
+		fprintf(stderr, "no wayland display\n");
+		return 1;
+	}
+	registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, NULL);
+	wl_display_roundtrip(display);
+	if (!shm) {
+		fprintf(stderr, "no wl_shm\n");
+		return 1;
+	}
+	page = sysconf(_SC_PAGESIZE);
+
+	test_reuse_and_best_fit();
+	test_coalescing();
+
+	wl_shm_destroy(shm);
+	wl_registry_destroy(registry);
+	wl_display_disconnect(display);
+	fprintf(stderr, "%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
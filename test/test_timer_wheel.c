@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <twclient/event_queue.h>
+
+/* timers spread over the first three levels of the wheel fire in the order of
+ * their deadlines, never early, and the cancelled ones never fire, including
+ * the ones cancelled after they were cascaded down a level. */
+
+struct timer_case {
+	uint32_t delay; /**< ms */
+	int cancel; /**< the case this one cancels when it fires, or -1 */
+	bool cancelled;
+	struct tw_event_timer *timer;
+	uint64_t fired; /**< ms since the start, 0 if it did not fire */
+};
+
+static struct tw_event_queue queue = {0};
+static uint64_t start;
+static int failures, fired, expected;
+static int order[32];
+
+static struct timer_case cases[] = {
+	{4200, -1}, {3, -1}, {700, -1}, {65, -1}, {64, -1},
+	//cancels the timer at 4180, cascaded to level 1 by then
+	{4100, 8},
+	//cancels the timer at 200, still on level 1
+	{130, 9},
+	{1, -1},
+	{4180, -1},
+	{200, -1},
+	//cancelled before it ever cascades
+	{4150, -1},
+	{63, -1},
+	{4096, -1},
+};
+
+#define N_CASES (sizeof(cases) / sizeof(*cases))
+
+static uint64_t
+now_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+#define check(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, __VA_ARGS__); \
+			failures++; \
+		} \
+	} while (0)
+
+static int
+timer_fired(struct tw_event *e, int fd)
+{
+	struct timer_case *c = &cases[e->arg.u];
+
+	(void)fd;
+	c->fired = now_ms() - start;
+	c->timer = NULL;
+	order[fired++] = e->arg.u;
+	if (c->cancel >= 0 && cases[c->cancel].timer) {
+		tw_event_queue_cancel_timer(&queue, cases[c->cancel].timer);
+		cases[c->cancel].timer = NULL;
+		cases[c->cancel].cancelled = true;
+		expected--;
+	}
+	if (fired == expected)
+		queue.quit = true;
+	return TW_EVENT_DEL;
+}
+
+int main(int argc, char *argv[])
+{
+	int last = -1;
+
+	tw_event_queue_init(&queue);
+	start = now_ms();
+	for (unsigned i = 0; i < N_CASES; i++) {
+		struct itimerspec spec = {
+			.it_value = {
+				.tv_sec = cases[i].delay / 1000,
+				.tv_nsec = (cases[i].delay % 1000) * 1000000,
+			},
+		};
+		struct tw_event e = {
+			.cb = timer_fired,
+			.arg.u = i,
+		};
+		cases[i].timer = tw_event_queue_start_timer(&queue, &spec, &e);
+		check(cases[i].timer, "cannot start timer %u\n", i);
+	}
+	expected = N_CASES;
+	tw_event_queue_cancel_timer(&queue, cases[10].timer);
+	cases[10].timer = NULL;
+	cases[10].cancelled = true;
+	expected--;
+
+	tw_event_queue_run(&queue);
+
+	for (int i = 0; i < fired; i++) {
+		struct timer_case *c = &cases[order[i]];
+
+		fprintf(stderr, "%5u ms fired at %5lu ms\n", c->delay,
+		        (unsigned long)c->fired);
+		check(c->fired >= c->delay, "%u ms fired early\n", c->delay);
+		check(last < 0 || cases[last].delay <= c->delay,
+		      "%u ms fired before %u ms\n", cases[last].delay,
+		      c->delay);
+		last = order[i];
+	}
+	for (unsigned i = 0; i < N_CASES; i++)
+		check(!cases[i].cancelled || !cases[i].fired,
+		      "cancelled %u ms fired\n", cases[i].delay);
+	check(fired == expected, "%d fired, %d expected\n", fired, expected);
+
+	tw_event_queue_close(&queue);
+	fprintf(stderr, "%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}